@@ -0,0 +1,339 @@
+/*!
+ * \file alias_bench.cpp
+ * \brief Microbenchmark of alias table construction, on dense rows of
+ *  num_topics outcomes and on sparse rows of tf-sized outcomes. Compares
+ *  AliasBuilder with the former builder, and checks they encode the same
+ *  distribution. With num_threads, also times ParallelAliasBuilder on the
+ *  dense rows, which must encode exactly what AliasBuilder does
+ *  Usage:
+ *    alias_bench <num_topics> <num_rows> [num_threads]
+ */
+
+#include "alias_builder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace lightlda
+{
+    /*! \brief the former builder, with correction loops and L/H queues */
+    class LegacyAliasBuilder
+    {
+    public:
+        void Build(const float* proportion, int32_t size, float mass,
+            int32_t& height, int32_t* kv_vector)
+        {
+            if (static_cast<int32_t>(q_.size()) < size)
+            {
+                q_.resize(size);
+                q_int_.resize(size);
+                L_.resize(size);
+                H_.resize(size);
+            }
+            int32_t mass_int = 0x7fffffff;
+            int32_t a_int = mass_int / size;
+            mass_int = a_int * size;
+            height = a_int;
+            int64_t mass_sum = 0;
+            for (int32_t i = 0; i < size; ++i)
+            {
+                q_[i] = proportion[i] / mass;
+                q_int_[i] = static_cast<int32_t>(q_[i] * mass_int);
+                mass_sum += q_int_[i];
+            }
+            if (mass_sum > mass_int)
+            {
+                int32_t more = static_cast<int32_t>(mass_sum - mass_int);
+                int32_t id = 0;
+                for (int32_t i = 0; i < more;)
+                {
+                    if (q_int_[id] >= 1)
+                    {
+                        --q_int_[id];
+                        ++i;
+                    }
+                    id = (id + 1) % size;
+                }
+            }
+            if (mass_sum < mass_int)
+            {
+                int32_t more = static_cast<int32_t>(mass_int - mass_sum);
+                int32_t id = 0;
+                for (int32_t i = 0; i < more; ++i)
+                {
+                    ++q_int_[id];
+                    id = (id + 1) % size;
+                }
+            }
+            for (int32_t k = 0; k < size; ++k)
+            {
+                kv_vector[2 * k] = k;
+                kv_vector[2 * k + 1] = (k + 1) * height;
+            }
+            int32_t L_head = 0, L_tail = 0, H_head = 0, H_tail = 0;
+            for (int32_t k = 0; k < size; ++k)
+            {
+                if (q_int_[k] < height)
+                    L_[L_tail++] = std::make_pair(k, q_int_[k]);
+                else
+                    H_[H_tail++] = std::make_pair(k, q_int_[k]);
+            }
+            while (L_head != L_tail && H_head != H_tail)
+            {
+                auto& l_pl = L_[L_head++];
+                auto& h_ph = H_[H_head++];
+                kv_vector[2 * l_pl.first] = h_ph.first;
+                kv_vector[2 * l_pl.first + 1] = l_pl.first * height + l_pl.second;
+                auto sum = h_ph.second + l_pl.second;
+                if (sum > 2 * height)
+                    H_[H_tail++] = std::make_pair(h_ph.first, sum - height);
+                else
+                    L_[L_tail++] = std::make_pair(h_ph.first, sum - height);
+            }
+            while (L_head != L_tail)
+            {
+                auto& p = L_[L_head++];
+                kv_vector[2 * p.first + 1] = p.first * height + p.second;
+            }
+            while (H_head != H_tail)
+            {
+                auto& p = H_[H_head++];
+                kv_vector[2 * p.first + 1] = p.first * height + p.second;
+            }
+        }
+    private:
+        std::vector<float> q_;
+        std::vector<int32_t> q_int_;
+        std::vector<std::pair<int32_t, int32_t>> L_;
+        std::vector<std::pair<int32_t, int32_t>> H_;
+    };
+
+    /*! \brief integer mass of each outcome encoded by an alias table */
+    void Decode(const int32_t* kv_vector, int32_t size, int32_t height,
+        std::vector<int64_t>& mass)
+    {
+        mass.assign(size, 0);
+        for (int32_t k = 0; k < size; ++k)
+        {
+            int64_t own = static_cast<int64_t>(kv_vector[2 * k + 1])
+                - static_cast<int64_t>(k) * height;
+            own = std::min<int64_t>(own, height);
+            mass[k] += own;
+            mass[kv_vector[2 * k]] += height - own;
+        }
+    }
+
+    struct Row
+    {
+        std::vector<float> proportion;
+        float mass;
+    };
+
+    /*!
+     * \brief Time the builders on rows, and report the largest difference
+     *  of the encoded masses, relative to the bucket height
+     */
+    void Run(const char* name, const std::vector<Row>& rows)
+    {
+        multiverso::lightlda::AliasBuilder builder;
+        LegacyAliasBuilder legacy;
+        size_t max_size = 0;
+        int64_t num_outcomes = 0;
+        for (auto& row : rows)
+        {
+            max_size = std::max(max_size, row.proportion.size());
+            num_outcomes += row.proportion.size();
+        }
+        std::vector<int32_t> kv_vector(2 * max_size), legacy_kv(2 * max_size);
+        int32_t height = 0, legacy_height = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (auto& row : rows)
+        {
+            legacy.Build(row.proportion.data(),
+                static_cast<int32_t>(row.proportion.size()), row.mass,
+                legacy_height, legacy_kv.data());
+        }
+        double legacy_seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+        start = std::chrono::steady_clock::now();
+        for (auto& row : rows)
+        {
+            builder.Build(row.proportion.data(),
+                static_cast<int32_t>(row.proportion.size()), row.mass,
+                height, kv_vector.data());
+        }
+        double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+        double max_diff = 0.0;
+        std::vector<int64_t> mass, legacy_mass;
+        for (auto& row : rows)
+        {
+            int32_t size = static_cast<int32_t>(row.proportion.size());
+            builder.Build(row.proportion.data(), size, row.mass,
+                height, kv_vector.data());
+            legacy.Build(row.proportion.data(), size, row.mass,
+                legacy_height, legacy_kv.data());
+            Decode(kv_vector.data(), size, height, mass);
+            Decode(legacy_kv.data(), size, legacy_height, legacy_mass);
+            for (int32_t k = 0; k < size; ++k)
+            {
+                double diff = std::fabs(static_cast<double>(
+                    mass[k] - legacy_mass[k])) / height;
+                max_diff = std::max(max_diff, diff);
+            }
+        }
+        printf("%-8s rows=%-7zu outcomes=%-10lld legacy=%8.2f ns/outcome "
+            "new=%8.2f ns/outcome speedup=%5.2fx max_diff=%.2e height\n",
+            name, rows.size(), static_cast<long long>(num_outcomes),
+            legacy_seconds * 1e9 / num_outcomes, seconds * 1e9 / num_outcomes,
+            legacy_seconds / seconds, max_diff);
+    }
+
+    /*! \brief barrier of a fixed number of threads */
+    class Barrier
+    {
+    public:
+        explicit Barrier(int32_t num_threads) 
+            : num_threads_(num_threads), waiting_(0), generation_(0) {}
+        void Wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            int64_t generation = generation_;
+            if (++waiting_ == num_threads_)
+            {
+                waiting_ = 0;
+                ++generation_;
+                cv_.notify_all();
+                return;
+            }
+            cv_.wait(lock, [&]() { return generation != generation_; });
+        }
+    private:
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        int32_t num_threads_;
+        int32_t waiting_;
+        int64_t generation_;
+    };
+
+    /*!
+     * \brief Time ParallelAliasBuilder with num_threads threads on rows,
+     *  and report the outcomes encoded differently from AliasBuilder
+     */
+    void RunParallel(const std::vector<Row>& rows, int32_t num_threads)
+    {
+        int32_t size = static_cast<int32_t>(rows[0].proportion.size());
+        multiverso::lightlda::AliasBuilder builder;
+        multiverso::lightlda::ParallelAliasBuilder parallel_builder(
+            num_threads, size);
+        std::vector<int32_t> kv_vector(2 * size), parallel_kv(2 * size);
+        int32_t height = 0, parallel_height = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (auto& row : rows)
+        {
+            builder.Build(row.proportion.data(), size, row.mass,
+                height, kv_vector.data());
+        }
+        double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+        Barrier barrier(num_threads);
+        auto wait = [&barrier]() { barrier.Wait(); };
+        auto build = [&](int32_t id)
+        {
+            for (auto& row : rows)
+            {
+                parallel_builder.Build(row.proportion.data(), size, row.mass,
+                    parallel_height, parallel_kv.data(), id, num_threads, wait);
+                barrier.Wait();
+            }
+        };
+        start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int32_t id = 1; id < num_threads; ++id)
+        {
+            threads.push_back(std::thread(build, id));
+        }
+        build(0);
+        for (auto& thread : threads) thread.join();
+        double parallel_seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+        // The last row is left in both tables
+        std::vector<int64_t> mass, parallel_mass;
+        Decode(kv_vector.data(), size, height, mass);
+        Decode(parallel_kv.data(), size, parallel_height, parallel_mass);
+        int32_t num_diff = 0;
+        for (int32_t k = 0; k < size; ++k)
+        {
+            num_diff += mass[k] != parallel_mass[k];
+        }
+        printf("%-8s rows=%-7zu threads=%-3d serial=%8.3f ms/row "
+            "parallel=%8.3f ms/row speedup=%5.2fx outcomes_differ=%d\n",
+            "parallel", rows.size(), num_threads, seconds * 1e3 / rows.size(),
+            parallel_seconds * 1e3 / rows.size(), seconds / parallel_seconds,
+            num_diff);
+    }
+
+    /*! \brief a row of size outcomes, skewed as word proposals are */
+    void MakeRow(int32_t size, std::mt19937& rng, Row& row)
+    {
+        std::gamma_distribution<float> gamma(0.1f, 1.0f);
+        row.proportion.resize(size);
+        row.mass = 0.0f;
+        for (int32_t k = 0; k < size; ++k)
+        {
+            row.proportion[k] = gamma(rng) + 0.01f;
+            row.mass += row.proportion[k];
+        }
+    }
+} // namespace lightlda
+
+int main(int argc, char* argv[])
+{
+    if (argc != 3 && argc != 4)
+    {
+        printf("Usage: alias_bench <num_topics> <num_rows> [num_threads]\n");
+        exit(1);
+    }
+    int32_t num_topics = atoi(argv[1]);
+    int32_t num_rows = atoi(argv[2]);
+    int32_t num_threads = argc == 4 ? atoi(argv[3]) : 0;
+    std::mt19937 rng(1);
+
+    // Dense rows hold all the topics
+    std::vector<lightlda::Row> dense(num_rows);
+    for (auto& row : dense)
+    {
+        lightlda::MakeRow(num_topics, rng, row);
+    }
+    lightlda::Run("dense", dense);
+    if (num_threads > 0) lightlda::RunParallel(dense, num_threads);
+
+    // Sparse rows hold tf topics, tf below the dense threshold of 2/3 of
+    // num_topics, drawn log-uniformly as word frequencies are heavy-tailed
+    int32_t max_tf = std::max(1, num_topics * 2 / 3);
+    std::uniform_real_distribution<double> log_tf(0.0, std::log(max_tf));
+    std::vector<lightlda::Row> sparse(num_rows);
+    for (auto& row : sparse)
+    {
+        int32_t tf = static_cast<int32_t>(std::exp(log_tf(rng)));
+        lightlda::MakeRow(std::max(1, std::min(tf, max_tf)), rng, row);
+    }
+    lightlda::Run("sparse", sparse);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#!/bin/bash
+# Compare the sampling kernels on a prepared data set. Each kernel is trained
+# with identical arguments in its own working directory, then the average
+# sampling throughput and the last reported likelihood are summarized.
+#
+# Usage: sh compare_samplers.sh <samplers> <lightlda arguments...>
+#   e.g. sh compare_samplers.sh "exact approx" -num_vocabs 111400 ...
+
+root=`pwd`
+bin=$root/../bin
+samplers=$1
+shift
+
+for sampler in $samplers
+do
+    dir=$root/compare.$sampler
+    mkdir -p $dir
+    cd $dir
+    rm -f LightLDA.*.log
+    $bin/lightlda -sampler $sampler "$@" > /dev/null
+    cd $root
+done
+
+printf "%-10s %20s %16s %16s %16s\n" "sampler" "tokens/thread/sec" "doc llh" "word llh" "normalized llh"
+for sampler in $samplers
+do
+    log=`ls $root/compare.$sampler/LightLDA.*.log | head -n 1`
+    throughput=`grep "sampling throughput" $log | sed 's/.*throughput: \([0-9.]*\).*/\1/' | awk '{ s += $1; n += 1 } END { if (n > 0) printf "%.2f", s / n }'`
+    doc_llh=`grep "doc likelihood" $log | tail -n 1 | awk '{ print $NF }'`
+    word_llh=`grep "word likelihood" $log | tail -n 1 | awk '{ print $NF }'`
+    norm_llh=`grep "Normalized likelihood" $log | tail -n 1 | awk '{ print $NF }'`
+    printf "%-10s %20s %16s %16s %16s\n" $sampler "$throughput" "$doc_llh" "$word_llh" "$norm_llh"
+done
@@ -2,6 +2,7 @@
 #include "alias_table.h"
 #include "data_stream.h"
 #include "data_block.h"
+#include "doc_topic_counter.h"
 #include "document.h"
 #include "meta.h"
 #include "util.h"
@@ -32,6 +33,10 @@ namespace multiverso { namespace lightlda
             InitDocument();
             //init alias table
             AliasTable* alias_table = new AliasTable();
+            // A second table takes the rows of the next block
+            AliasTable* next_alias_table = nullptr;
+            if (Config::pipeline_alias && Config::num_blocks > 1)
+                next_alias_table = new AliasTable();
             //init inferers
             std::vector<Inferer*> inferers;
             Barrier barrier(Config::num_local_workers);
@@ -39,7 +44,8 @@ namespace multiverso { namespace lightlda
             // pthread_barrier_init(&barrier, nullptr, Config::num_local_workers);
             for (int32_t i = 0; i < Config::num_local_workers; ++i)
             {
-               inferers.push_back(new Inferer(alias_table, data_stream, 
+               inferers.push_back(new Inferer(alias_table, next_alias_table,
+                    data_stream, 
                     &meta, model, 
                     &barrier, i, Config::num_local_workers));
             }
@@ -59,6 +65,7 @@ namespace multiverso { namespace lightlda
             // pthread_barrier_destroy(&barrier);
             delete data_stream;
             delete alias_table;
+            delete next_alias_table;
             delete model;
         }
     private:
@@ -104,7 +111,9 @@ namespace multiverso { namespace lightlda
 
         static void InitDocument()
         {
-            xorshift_rng rng;
+            // Stream -1, apart from the streams of the sampling threads
+            philox_rng rng(Config::seed,
+                philox_rng::StreamId(0, -1));
             for (int32_t block = 0; block < Config::num_blocks; ++block)
             {
                 data_stream->BeforeDataAccess();
@@ -134,7 +143,7 @@ namespace multiverso { namespace lightlda
 
         static void DumpDocTopic()
         {
-            Row<int32_t> doc_topic_counter(0, Format::Sparse, kMaxDocLength); 
+            DocTopicCounter doc_topic_counter(Config::num_topics);
             for (int32_t block = 0; block < Config::num_blocks; ++block)
             {
                 std::ofstream fout("doc_topic." + std::to_string(block));
@@ -143,10 +152,9 @@ namespace multiverso { namespace lightlda
                 for (int i = 0; i < data_block.Size(); ++i)
                 {
                     Document* doc = data_block.GetOneDoc(i);
-                    doc_topic_counter.Clear();
                     doc->GetDocTopicVector(doc_topic_counter);
                     fout << i << " ";  // doc id
-                    Row<int32_t>::iterator iter = doc_topic_counter.Iterator();
+                    DocTopicCounter::Iterator iter = doc_topic_counter.GetIterator();
                     while (iter.HasNext())
                     {
                         fout << " " << iter.Key() << ":" << iter.Value();
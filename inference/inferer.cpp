@@ -11,54 +11,105 @@
 #include <multiverso/log.h>
 #include <multiverso/barrier.h>
 
+#include <utility>
+
 namespace multiverso { namespace lightlda
 {
-    Inferer::Inferer(AliasTable* alias_table,
+    Inferer::Inferer(AliasTable* alias_table, AliasTable* next_alias_table,
         IDataStream * data_stream,
         Meta* meta, LocalModel * model,
         Barrier* barrier, 
         int32_t id, int32_t thread_num):
-        alias_(alias_table), data_stream_(data_stream),
+        alias_(alias_table), next_alias_(next_alias_table),
+        data_stream_(data_stream),
         meta_(meta), model_(model),
         barrier_(barrier), 
         id_(id), thread_num_(thread_num) 
     {
         sampler_ = new LightDocSampler();
+        sampler_->Seed(Config::seed, philox_rng::StreamId(0, id_));
     }
 
     Inferer::~Inferer()
     {
+        if (builder_.joinable()) builder_.join();
         delete sampler_;
     }
 
     void Inferer::BeforeIteration(int32_t block)
     {
+        // Rows of a block after the first were built while the previous
+        // block was sampled, each inferer swaps to them
+        bool prebuilt = next_alias_ != nullptr && block > 0;
+        if (prebuilt) std::swap(alias_, next_alias_);
+        StopWatch watch; watch.Start();
         //init current data block
         if(id_ == 0)
         {
 	    data_stream_->BeforeDataAccess();
             DataBlock& data = data_stream_->CurrDataBlock();
             data.set_meta(&(meta_->local_vocab(block)));
-            alias_->Init(meta_->alias_index(block, 0));
-            alias_->Build(-1, model_);
+            if (Config::keep_doc_topic && !data.HasDocTopicCounts())
+                data.BuildDocTopicCounts();
+            if (prebuilt)
+            {
+                builder_.join();
+            }
+            else
+            {
+                alias_->Init(meta_->alias_index(block, 0));
+                if (!AliasTable::ParallelBeta(thread_num_))
+                    alias_->Build(-1, model_);
+            }
 	}
         barrier_->Wait();
+        if (!prebuilt && AliasTable::ParallelBeta(thread_num_))
+        {
+            alias_->BuildBeta(model_, id_, thread_num_, barrier_);
+            barrier_->Wait();
+        }
 
         // build alias table 
 	DataBlock& data = data_stream_->CurrDataBlock();
         const LocalVocab& local_vocab = data.meta();
-        StopWatch watch; watch.Start();
-        for (const int32_t* pword = local_vocab.begin(0) + id_;
-            pword < local_vocab.end(0);
-            pword += thread_num_)
+        // With lazy alias, sampler builds word rows on first use
+        if (!prebuilt && !Config::lazy_alias)
         {
-            alias_->Build(*pword, model_);
+            for (const int32_t* pword = local_vocab.begin(0) + id_;
+                pword < local_vocab.end(0);
+                pword += thread_num_)
+            {
+                alias_->Refresh(*pword, model_);
+            }
+            barrier_->Wait();
         }
-        barrier_->Wait();
         if (id_ == 0)
         {
             Log::Info("block=%d, Alias Time used: %.2f s \n", block, watch.ElapsedSeconds());
+            // The table of the previous block is free once all inferers
+            // are past the barrier above
+            if (next_alias_ != nullptr && block + 1 < Config::num_blocks)
+            {
+                builder_ = std::thread(&Inferer::PrebuildAlias, next_alias_,
+                    meta_, model_, block + 1);
+            }
+        }
+    }
+
+    void Inferer::PrebuildAlias(AliasTable* alias, Meta* meta,
+        LocalModel* model, int32_t block)
+    {
+        alias->Init(meta->alias_index(block, 0));
+        alias->Build(-1, model);
+        // EnsureBuilt marks the rows built, for lazy alias as well
+        const LocalVocab& local_vocab = meta->local_vocab(block);
+        for (const int32_t* pword = local_vocab.begin(0);
+            pword < local_vocab.end(0); ++pword)
+        {
+            alias->EnsureBuilt(*pword, model);
         }
+        // Free the buffers of this thread
+        alias->Clear();
     }
 
     void Inferer::DoIteration(int32_t iter)
@@ -6,6 +6,8 @@
 #define LIGHTLDA_INFERER_H_
 
 // #include <pthread.h>
+#include <thread>
+
 #include <multiverso/multiverso.h>
 #include <multiverso/log.h>
 #include <multiverso/barrier.h>
@@ -26,7 +28,11 @@ namespace lightlda
     class Inferer
     {
     public:
-        Inferer(AliasTable* alias_table, 
+        /*!
+         * \param next_alias_table second alias table, to build the rows of
+         *  the next block while this one is sampled, nullptr if not needed
+         */
+        Inferer(AliasTable* alias_table, AliasTable* next_alias_table,
                 IDataStream * data_stream,
                 Meta* meta, LocalModel * model,
                 Barrier* barrier, 
@@ -37,7 +43,14 @@ namespace lightlda
         void DoIteration(int32_t iter);
         void EndIteration();
     private:
+        /*! \brief Build the alias rows of all the words of a block */
+        static void PrebuildAlias(AliasTable* alias, Meta* meta,
+            LocalModel* model, int32_t block);
         AliasTable* alias_;
+        /*! \brief table of the next block, the two are swapped per block */
+        AliasTable* next_alias_;
+        /*! \brief builder of next_alias_, run by inferer 0 */
+        std::thread builder_;
         IDataStream * data_stream_;
         Meta* meta_;
         LocalModel * model_;
@@ -0,0 +1,257 @@
+#include "alias_builder.h"
+
+#include <algorithm>
+
+namespace
+{
+    /*! \brief Round down proportion * scale of [begin, end), return the sum */
+    int64_t ScaleMass(const float* proportion, int32_t begin, int32_t end,
+        double scale, int32_t* mass_int)
+    {
+        int64_t sum = 0;
+        for (int32_t k = begin; k < end; ++k)
+        {
+            mass_int[k] = static_cast<int32_t>(proportion[k] * scale);
+            sum += mass_int[k];
+        }
+        return sum;
+    }
+
+    /*!
+     * \brief Get the scale to redo a normalization whose sum exceeded total.
+     *  mass is summed in float, so it may be short of the actual sum. 
+     *  Rounding down loses less than 1 per outcome, the actual sum is below
+     *  sum + size, rescale to be sure to stay within total
+     */
+    double Rescale(double scale, int64_t total, int32_t size, int64_t sum)
+    {
+        return scale * static_cast<double>(total - size) / (sum + size);
+    }
+
+    /*!
+     * \brief Spread the remainder evenly over [begin, end) of size outcomes,
+     *  the first (remainder % size) outcomes take one more
+     */
+    void SpreadRemainder(int64_t remainder, int32_t size, int32_t begin,
+        int32_t end, int32_t* mass_int)
+    {
+        int32_t base = static_cast<int32_t>(remainder / size);
+        int32_t extra = static_cast<int32_t>(remainder % size);
+        for (int32_t k = begin; k < end; ++k)
+        {
+            mass_int[k] += base + (k < extra);
+        }
+    }
+
+    /*! \brief Get the first of the part id of size items split in parts */
+    int32_t Split(int32_t size, int32_t id, int32_t parts)
+    {
+        return static_cast<int32_t>(static_cast<int64_t>(size) * id / parts);
+    }
+}
+
+namespace multiverso { namespace lightlda
+{
+    void AliasBuilder::Build(const float* proportion, int32_t size,
+        float mass, int32_t& height, int32_t* kv_vector)
+    {
+        if (static_cast<int32_t>(mass_int_.size()) < size)
+        {
+            mass_int_.resize(size);
+            small_.resize(size);
+            large_.resize(size);
+        }
+        height = 0x7fffffff / size;
+        Normalize(proportion, size, mass, height);
+
+        int32_t* mass_int = mass_int_.data();
+        int32_t* small = small_.data();
+        int32_t* large = large_.data();
+        // Every outcome is written to both stacks, only one of them keeps it
+        int32_t num_small = 0, num_large = 0;
+        for (int32_t k = 0; k < size; ++k)
+        {
+            int32_t is_small = mass_int[k] < height;
+            small[num_small] = k;
+            large[num_large] = k;
+            num_small += is_small;
+            num_large += 1 - is_small;
+        }
+        // Vose: a small outcome tops up its bucket with mass of a large one,
+        // which becomes small once it has less than height left
+        while (num_small != 0 && num_large != 0)
+        {
+            int32_t l = small[--num_small];
+            int32_t h = large[num_large - 1];
+            kv_vector[2 * l] = h;
+            kv_vector[2 * l + 1] = l * height + mass_int[l];
+            mass_int[h] -= height - mass_int[l];
+            int32_t moved = mass_int[h] < height;
+            small[num_small] = h;
+            num_small += moved;
+            num_large -= moved;
+        }
+        // Outcomes left fill their own buckets
+        while (num_small != 0)
+        {
+            int32_t k = small[--num_small];
+            kv_vector[2 * k] = k;
+            kv_vector[2 * k + 1] = k * height + mass_int[k];
+        }
+        while (num_large != 0)
+        {
+            int32_t k = large[--num_large];
+            kv_vector[2 * k] = k;
+            kv_vector[2 * k + 1] = k * height + mass_int[k];
+        }
+    }
+
+    void AliasBuilder::Normalize(const float* proportion, int32_t size,
+        float mass, int32_t height)
+    {
+        const int64_t total = static_cast<int64_t>(height) * size;
+        int32_t* mass_int = mass_int_.data();
+        double scale = total / static_cast<double>(mass);
+        int64_t sum = ScaleMass(proportion, 0, size, scale, mass_int);
+        if (sum > total)
+        {
+            scale = Rescale(scale, total, size, sum);
+            sum = ScaleMass(proportion, 0, size, scale, mass_int);
+        }
+        SpreadRemainder(total - sum, size, 0, size, mass_int);
+    }
+
+    ParallelAliasBuilder::ParallelAliasBuilder(int32_t num_threads,
+        int32_t max_size)
+        : mass_int_(max_size), small_(max_size), large_(max_size),
+        deficit_(max_size), excess_(max_size), thread_sum_(num_threads),
+        thread_small_(num_threads), thread_large_(num_threads),
+        thread_deficit_(num_threads), thread_excess_(num_threads)
+    {}
+
+    void ParallelAliasBuilder::Build(const float* proportion, int32_t size,
+        float mass, int32_t& height, int32_t* kv_vector, int32_t id,
+        int32_t num_threads, const std::function<void()>& wait)
+    {
+        const int32_t h = 0x7fffffff / size;
+        const int64_t total = static_cast<int64_t>(h) * size;
+        if (id == 0) height = h;
+        int32_t* mass_int = mass_int_.data();
+        int32_t begin = Split(size, id, num_threads);
+        int32_t end = Split(size, id + 1, num_threads);
+
+        // 1. Normalize the outcomes of this thread
+        double scale = total / static_cast<double>(mass);
+        thread_sum_[id] = ScaleMass(proportion, begin, end, scale, mass_int);
+        wait();
+        int64_t sum = 0;
+        for (int32_t t = 0; t < num_threads; ++t) sum += thread_sum_[t];
+        if (sum > total)
+        {
+            scale = Rescale(scale, total, size, sum);
+            wait();
+            thread_sum_[id] = ScaleMass(proportion, begin, end, scale, mass_int);
+            wait();
+            sum = 0;
+            for (int32_t t = 0; t < num_threads; ++t) sum += thread_sum_[t];
+        }
+        SpreadRemainder(total - sum, size, begin, end, mass_int);
+
+        // 2. List the small and large outcomes in order, each thread places 
+        // its own after those of the threads before
+        int32_t num_small = 0;
+        for (int32_t k = begin; k < end; ++k)
+        {
+            num_small += mass_int[k] < h;
+        }
+        thread_small_[id] = num_small;
+        thread_large_[id] = (end - begin) - num_small;
+        wait();
+        int32_t small_begin = 0, large_begin = 0;
+        int32_t total_small = 0, total_large = 0;
+        for (int32_t t = 0; t < num_threads; ++t)
+        {
+            if (t < id)
+            {
+                small_begin += thread_small_[t];
+                large_begin += thread_large_[t];
+            }
+            total_small += thread_small_[t];
+            total_large += thread_large_[t];
+        }
+        int32_t s = small_begin, l = large_begin;
+        int64_t deficit = 0, excess = 0;
+        for (int32_t k = begin; k < end; ++k)
+        {
+            if (mass_int[k] < h)
+            {
+                small_[s] = k;
+                deficit += h - mass_int[k];
+                deficit_[s++] = deficit;
+            }
+            else
+            {
+                large_[l] = k;
+                excess += mass_int[k] - h;
+                excess_[l++] = excess;
+            }
+        }
+        thread_deficit_[id] = deficit;
+        thread_excess_[id] = excess;
+        wait();
+        int64_t deficit_offset = 0, excess_offset = 0;
+        for (int32_t t = 0; t < id; ++t)
+        {
+            deficit_offset += thread_deficit_[t];
+            excess_offset += thread_excess_[t];
+        }
+        for (int32_t i = small_begin; i < s; ++i) deficit_[i] += deficit_offset;
+        for (int32_t j = large_begin; j < l; ++j) excess_[j] += excess_offset;
+        wait();
+
+        // 3. Fill the buckets of a share of the small outcomes. Small outcome
+        // i is topped up by the first large one not used up before i
+        int64_t* deficit_end = deficit_.data() + total_small;
+        int64_t* excess_end = excess_.data() + total_large;
+        int32_t share_begin = Split(total_small, id, num_threads);
+        int32_t share_end = Split(total_small, id + 1, num_threads);
+        if (share_begin < share_end)
+        {
+            int64_t before = share_begin == 0 ? 0 : deficit_[share_begin - 1];
+            int32_t j = static_cast<int32_t>(std::lower_bound(
+                excess_.data(), excess_end, before) - excess_.data());
+            for (int32_t i = share_begin; i < share_end; ++i)
+            {
+                before = i == 0 ? 0 : deficit_[i - 1];
+                while (excess_[j] < before) ++j;
+                int32_t k = small_[i];
+                kv_vector[2 * k] = large_[j];
+                kv_vector[2 * k + 1] = k * h + mass_int[k];
+            }
+        }
+
+        // 4. Fill the buckets of a share of the large outcomes. Large outcome
+        // j is used up by the first small outcome whose deficit prefix 
+        // passes its excess prefix, the rest of its mass stays in its bucket
+        // and the next large one tops it up
+        const int64_t all_deficit = total_small == 0 ? 0 : *(deficit_end - 1);
+        share_begin = Split(total_large, id, num_threads);
+        share_end = Split(total_large, id + 1, num_threads);
+        if (share_begin < share_end)
+        {
+            int32_t i = static_cast<int32_t>(std::upper_bound(
+                deficit_.data(), deficit_end, excess_[share_begin]) 
+                - deficit_.data());
+            for (int32_t j = share_begin; j < share_end; ++j)
+            {
+                while (i < total_small && deficit_[i] <= excess_[j]) ++i;
+                int32_t k = large_[j];
+                int64_t used = i < total_small ? deficit_[i] : all_deficit;
+                kv_vector[2 * k] = i < total_small ? large_[j + 1] : k;
+                kv_vector[2 * k + 1] = static_cast<int32_t>(
+                    static_cast<int64_t>(k) * h + h + excess_[j] - used);
+            }
+        }
+    }
+} // namespace lightlda
+} // namespace multiverso
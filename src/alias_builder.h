@@ -0,0 +1,105 @@
+/*!
+ * \file alias_builder.h
+ * \brief Defines the builder of alias tables
+ */
+
+#ifndef LIGHTLDA_ALIAS_BUILDER_H_
+#define LIGHTLDA_ALIAS_BUILDER_H_
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace multiverso { namespace lightlda
+{
+    /*!
+     * \brief AliasBuilder builds an alias table of a discrete distribution
+     *  in integer form. The total mass 2^31 - 1 is rounded down to height *
+     *  size, with bucket k holding the pair (alias, k * height + mass of k
+     *  in the bucket): a 31-bit sample falls into bucket sample / height,
+     *  and takes k if sample < the second value, otherwise the alias.
+     *  AliasBuilder keeps the scratch buffers, one per thread is needed.
+     */
+    class AliasBuilder
+    {
+    public:
+        AliasBuilder() {}
+        /*!
+         * \brief Build the alias table of size outcomes
+         * \param proportion unnormalized probability of each outcome
+         * \param size number of outcomes
+         * \param mass sum of proportion
+         * \param height output, mass of each bucket
+         * \param kv_vector output, 2 * size ints
+         */
+        void Build(const float* proportion, int32_t size, float mass,
+            int32_t& height, int32_t* kv_vector);
+    private:
+        /*! \brief scale proportion to integers summing to height * size */
+        void Normalize(const float* proportion, int32_t size, float mass,
+            int32_t height);
+        /*! \brief integer mass of each outcome, left in its bucket */
+        std::vector<int32_t> mass_int_;
+        /*! \brief stacks of outcomes with mass below and above height */
+        std::vector<int32_t> small_;
+        std::vector<int32_t> large_;
+
+        // No copying allowed
+        AliasBuilder(const AliasBuilder&);
+        void operator=(const AliasBuilder&);
+    };
+
+    /*!
+     * \brief ParallelAliasBuilder builds one alias table with several 
+     *  threads, for a row too long for one thread, e.g. the beta row of a
+     *  very large num_topics. Masses are normalized as by AliasBuilder.
+     *  Buckets are then filled by a sweep over the prefix sums of the 
+     *  deficits of small outcomes and of the excesses of large outcomes:
+     *  small outcome i is aliased to the first large outcome whose excess
+     *  prefix reaches the deficit prefix before i, and a large outcome
+     *  exhausted by small ones is aliased to the next large one. Every
+     *  bucket is found by a search in the prefix sums, so the threads fill
+     *  their shares independently, and the table does not depend on the
+     *  number of threads.
+     */
+    class ParallelAliasBuilder
+    {
+    public:
+        /*!
+         * \param num_threads max number of threads building together
+         * \param max_size max number of outcomes
+         */
+        ParallelAliasBuilder(int32_t num_threads, int32_t max_size);
+        /*!
+         * \brief Build the alias table of size outcomes, see 
+         *  AliasBuilder::Build. Each of the num_threads threads calls with 
+         *  its id, wait must be a barrier of all of them. The table is 
+         *  complete once all the threads returned
+         */
+        void Build(const float* proportion, int32_t size, float mass,
+            int32_t& height, int32_t* kv_vector, int32_t id, 
+            int32_t num_threads, const std::function<void()>& wait);
+    private:
+        std::vector<int32_t> mass_int_;
+        /*! \brief small and large outcomes, in order */
+        std::vector<int32_t> small_;
+        std::vector<int32_t> large_;
+        /*! \brief inclusive prefix sums of the deficits of small_ */
+        std::vector<int64_t> deficit_;
+        /*! \brief inclusive prefix sums of the excesses of large_ */
+        std::vector<int64_t> excess_;
+        /*! \brief partial results of each thread */
+        std::vector<int64_t> thread_sum_;
+        std::vector<int32_t> thread_small_;
+        std::vector<int32_t> thread_large_;
+        std::vector<int64_t> thread_deficit_;
+        std::vector<int64_t> thread_excess_;
+
+        // No copying allowed
+        ParallelAliasBuilder(const ParallelAliasBuilder&);
+        void operator=(const ParallelAliasBuilder&);
+    };
+} // namespace lightlda
+} // namespace multiverso
+
+#endif // LIGHTLDA_ALIAS_BUILDER_H_
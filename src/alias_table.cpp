@@ -1,21 +1,29 @@
 #include "alias_table.h"
 
+#include "alias_builder.h"
 #include "common.h"
 #include "model.h"
 #include "util.h"
 #include "meta.h"
 
+#include <multiverso/barrier.h>
 #include <multiverso/lock.h>
 #include <multiverso/log.h>
 #include <multiverso/row.h>
 #include <multiverso/row_iter.h>
 
+#include <algorithm>
+#include <thread>
+
 namespace multiverso { namespace lightlda
 {
     _THREAD_LOCAL std::vector<float>* AliasTable::q_w_proportion_;
-    _THREAD_LOCAL std::vector<int32_t>* AliasTable::q_w_proportion_int_;
-    _THREAD_LOCAL std::vector<std::pair<int32_t, int32_t>>* AliasTable::L_;
-    _THREAD_LOCAL std::vector<std::pair<int32_t, int32_t>>* AliasTable::H_;
+    _THREAD_LOCAL std::vector<int32_t>* AliasTable::topics_;
+    _THREAD_LOCAL std::vector<int32_t>* AliasTable::kv_buffer_;
+    _THREAD_LOCAL AliasBuilder* AliasTable::builder_;
+    _THREAD_LOCAL AliasTable::ProposalStacks* AliasTable::stacks_;
+    _THREAD_LOCAL int64_t AliasTable::stacks_serial_;
+    std::atomic<int64_t> AliasTable::num_tables_(0);
 
     AliasTable::AliasTable()
     {
@@ -25,11 +33,49 @@ namespace multiverso { namespace lightlda
         beta_ = Config::beta;
         beta_sum_ = beta_ * num_vocabs_;
         memory_block_ = new int32_t[memory_size_];
+        table_index_ = nullptr;
         
         beta_kv_vector_ = new int32_t[2 * num_topics_];
+        if (ParallelBeta(Config::num_local_workers))
+        {
+            beta_builder_.reset(new ParallelAliasBuilder(
+                Config::num_local_workers, num_topics_));
+            beta_proportion_.resize(num_topics_);
+            beta_thread_mass_.resize(Config::num_local_workers);
+        }
 
         height_.resize(num_vocabs_);
         mass_.resize(num_vocabs_);
+        num_buckets_.resize(num_vocabs_, 0);
+        inv_summary_.reset(new std::atomic<float>[num_topics_]);
+        for (int32_t k = 0; k < num_topics_; ++k)
+            inv_summary_[k].store(0.0f, std::memory_order_relaxed);
+        sparse_record_ints_ = AliasTableIndex::SparseRecordInts();
+
+        // A stack is drawn from one bulk access of the random numbers
+        stack_size_ = std::min(Config::proposal_stack, philox_rng::kBufferSize);
+        if (stack_size_ > 0)
+        {
+            stack_slot_.resize(num_vocabs_, -1);
+            version_.resize(num_vocabs_, 0);
+        }
+        num_stacks_.store(0, std::memory_order_relaxed);
+        num_versions_.store(0, std::memory_order_relaxed);
+        serial_ = num_tables_.fetch_add(1) + 1;
+
+        epoch_ = 0;
+        valid_epoch_ = 0;
+        iteration_ = 0;
+        built_epoch_.resize(num_vocabs_, -1);
+        built_iteration_.resize(num_vocabs_, 0);
+        built_count_.resize(num_vocabs_, 0);
+        build_state_.reset(new std::atomic<int32_t>[num_vocabs_]);
+        drift_.reset(new std::atomic<int32_t>[num_vocabs_]);
+        for (int32_t word = 0; word < num_vocabs_; ++word)
+        {
+            build_state_[word].store(-1, std::memory_order_relaxed);
+            drift_[word].store(0, std::memory_order_relaxed);
+        }
     }
 
     AliasTable::~AliasTable()
@@ -38,86 +84,263 @@ namespace multiverso { namespace lightlda
         delete[] beta_kv_vector_;
     }
 
-    void AliasTable::Init(AliasTableIndex* table_index)
+    void AliasTable::Init(AliasTableIndex* table_index, int32_t iteration)
     {
+        // Callers synchronize before using the table, which publishes epoch_
+        epoch_ = (epoch_ + 1) & 0x3fffffff;
+        // Rows stay in the memory pool only while the index is the same,
+        // e.g. in every iteration over a single block of a single slice,
+        // or if every index puts a word at the same place
+        bool same_layout = table_index == table_index_ ||
+            (table_index_ != nullptr && table_index->shared_layout());
+        if (!same_layout || epoch_ < valid_epoch_)
+            valid_epoch_ = epoch_;
         table_index_ = table_index;
+        iteration_ = iteration;
+        num_stacks_.store(0, std::memory_order_relaxed);
     }
 
-    int32_t AliasTable::Build(int32_t word, ModelBase* model)
-    {       
+    bool AliasTable::Fresh(int32_t word) const
+    {
+        return Config::alias_staleness > 0 && built_epoch_[word] >= valid_epoch_
+            && iteration_ - built_iteration_[word] < Config::alias_max_age
+            && drift_[word].load(std::memory_order_relaxed) <=
+                Config::alias_staleness * built_count_[word];
+    }
+
+    bool AliasTable::Refresh(int32_t word, ModelBase* model)
+    {
+        // A row of this epoch was built by Prebuild before the Init
+        if (built_epoch_[word] == epoch_ || Fresh(word))
+        {
+            // Only dense words ever get a stack
+            if (stack_size_ > 0 && stack_slot_[word] != -1) AssignStack(word);
+            return false;
+        }
+        Build(word, model);
+        return true;
+    }
+
+    void AliasTable::Prebuild(AliasTableIndex* table_index, 
+        const int32_t* begin, const int32_t* end, ModelBase* model)
+    {
+        const int32_t next_epoch = (epoch_ + 1) & 0x3fffffff;
+        // Rows of another index are only kept over the Init if the layout
+        // is shared
+        bool shared = table_index->shared_layout();
+        for (const int32_t* pword = begin; pword < end; ++pword)
+        {
+            if (shared && Fresh(*pword)) continue;
+            BuildWord(*pword, model, table_index, next_epoch);
+        }
+    }
+
+    void AliasTable::EnsureBuilt(int32_t word, ModelBase* model)
+    {
+        const int32_t building = epoch_ * 2, built = epoch_ * 2 + 1;
+        std::atomic<int32_t>& state = build_state_[word];
+        int32_t current = state.load(std::memory_order_acquire);
+        if (current == built) return;
+        if (current != building && state.compare_exchange_strong(current, 
+            building, std::memory_order_acq_rel))
+        {
+            Refresh(word, model);
+            state.store(built, std::memory_order_release);
+            return;
+        }
+        while (state.load(std::memory_order_acquire) != built)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    void AliasTable::AllocBuffers()
+    {
         if (q_w_proportion_ == nullptr)
             q_w_proportion_ = new std::vector<float>(num_topics_);
-        if (q_w_proportion_int_ == nullptr)
-            q_w_proportion_int_ = new std::vector<int32_t>(num_topics_);
-        if (L_ == nullptr)
-            L_ = new std::vector<std::pair<int32_t, int32_t>>(num_topics_);
-        if (H_ == nullptr)
-            H_ = new std::vector<std::pair<int32_t, int32_t>>(num_topics_);
+        if (topics_ == nullptr)
+            topics_ = new std::vector<int32_t>(num_topics_);
+        if (kv_buffer_ == nullptr)
+            kv_buffer_ = new std::vector<int32_t>(2 * num_topics_);
+        if (builder_ == nullptr)
+            builder_ = new AliasBuilder();
+    }
+
+    int32_t AliasTable::Build(int32_t word, ModelBase* model)
+    {       
         // Compute the proportion
-        Row<int64_t>& summary_row = model->GetSummaryRow();
         if (word == -1) // build alias row for beta 
         {
+            AllocBuffers();
+            SummaryRow summary_row = model->GetSummaryRow();
             beta_mass_ = 0;
             for (int32_t k = 0; k < num_topics_; ++k)
             {
-                (*q_w_proportion_)[k] = beta_ / (summary_row.At(k) + beta_sum_);
+                UpdateInvSummary(k, summary_row.At(k));
+                (*q_w_proportion_)[k] = beta_ * InvSummary(k);
                 beta_mass_ += (*q_w_proportion_)[k];
             }
-            AliasMultinomialRNG(num_topics_, beta_mass_, beta_height_, 
-                beta_kv_vector_);
+            builder_->Build(q_w_proportion_->data(), num_topics_, beta_mass_,
+                beta_height_, beta_kv_vector_);
         }
         else // build alias row for word
-        {            
-            WordEntry& word_entry = table_index_->word_entry(word);
-            Row<int32_t>& word_topic_row = model->GetWordTopicRow(word);
-            int32_t size = 0;
-            mass_[word] = 0;
-            if (word_entry.is_dense)
+        {
+            BuildWord(word, model, table_index_, epoch_);
+        }
+        return 0;
+    }
+
+    void AliasTable::BuildWord(int32_t word, ModelBase* model,
+        AliasTableIndex* table_index, int32_t epoch)
+    {
+        AllocBuffers();
+        WordEntry& word_entry = table_index->word_entry(word);
+        WordTopicRow word_topic_row = model->GetWordTopicRow(word);
+        int32_t* kv_vector = memory_block_ + word_entry.begin_offset;
+        int32_t size = 0, count = 0;
+        mass_[word] = 0;
+        if (word_entry.is_dense)
+        {
+            size = num_topics_;
+            for (int32_t k = 0; k < num_topics_; ++k)
+            {
+                int32_t n_tw = word_topic_row.At(k);
+                (*q_w_proportion_)[k] = (n_tw + beta_) * InvSummary(k);
+                mass_[word] += (*q_w_proportion_)[k];
+                count += n_tw;
+            }
+            builder_->Build(q_w_proportion_->data(), size, mass_[word],
+                height_[word], kv_vector);
+            // A word is built by one thread, and sampled after
+            if (stack_size_ > 0) AssignStack(word);
+        }
+        else // word_entry.is_dense = false
+        {
+            int32_t nonzero = word_topic_row.NonzeroSize();
+            int32_t* topics = topics_->data();
+            float* proportion = q_w_proportion_->data();
+            float mass = 0.0f;
+            // With -lazy_alias the row may gain topics while iterated
+            if (nonzero > 0)
             {
-                size = num_topics_;
-                for (int32_t k = 0; k < num_topics_; ++k)
+                word_topic_row.ForEach([&](int32_t t, int32_t n_tw)
                 {
-                    (*q_w_proportion_)[k] = (word_topic_row.At(k) + beta_)
-                        / (summary_row.At(k) + beta_sum_);
-                    mass_[word] += (*q_w_proportion_)[k];
-                }
+                    topics[size] = t;
+                    proportion[size] = n_tw * InvSummary(t);
+                    mass += proportion[size];
+                    count += n_tw;
+                    return ++size < nonzero;
+                });
+            }
+            mass_[word] = mass;
+            if (size == 0)
+            {
+                Log::Error("Fail to build alias row, capacity of row = %d\n",
+                    word_topic_row.NonzeroSize());
             }
-            else // word_entry.is_dense = false
+            // The row may also lose topics concurrently, the buckets 
+            // built are counted by size
+            int32_t* kv_buffer = kv_buffer_->data();
+            builder_->Build(q_w_proportion_->data(), size, mass_[word],
+                height_[word], kv_buffer);
+            // Pack each bucket as threshold, own topic and alias topic
+            for (int32_t k = 0; k < size; ++k)
             {
-                word_entry.capacity = word_topic_row.NonzeroSize();
-                int32_t* idx_vector = memory_block_ + word_entry.begin_offset 
-                    + 2 * word_entry.capacity;
-                Row<int32_t>::iterator iter = word_topic_row.Iterator();
-                while (iter.HasNext())
+                int32_t* record = kv_vector + sparse_record_ints_ * k;
+                record[0] = kv_buffer[2 * k + 1];
+                if (sparse_record_ints_ == 2)
                 {
-                    int32_t t = iter.Key();
-                    int32_t n_tw = iter.Value();
-                    int64_t n_t = summary_row.At(t);
-                    idx_vector[size] = t;
-                    (*q_w_proportion_)[size] = (n_tw) / (n_t + beta_sum_);
-                    mass_[word] += (*q_w_proportion_)[size];
-                    ++size;
-                    iter.Next();
+                    record[1] = static_cast<int32_t>(
+                        static_cast<uint32_t>(topics[k]) |
+                        (static_cast<uint32_t>(topics[kv_buffer[2 * k]]) << 16));
                 }
-                if (size == 0)
+                else
                 {
-                    Log::Error("Fail to build alias row, capacity of row = %d\n",
-                        word_topic_row.NonzeroSize());
+                    record[1] = topics[k];
+                    record[2] = topics[kv_buffer[2 * k]];
                 }
             }
-            AliasMultinomialRNG(size, mass_[word], height_[word], 
-                memory_block_ + word_entry.begin_offset);
         }
-        return 0;
+        num_buckets_[word] = size;
+        built_epoch_[word] = epoch;
+        built_iteration_[word] = iteration_;
+        built_count_[word] = count;
+        drift_[word].store(0, std::memory_order_relaxed);
+    }
+
+    bool AliasTable::ParallelBeta(int32_t num_threads)
+    {
+        return num_threads > 1 && Config::num_topics >= kMinParallelTopics;
     }
 
-    int32_t AliasTable::Propose(int32_t word, xorshift_rng& rng)
+    void AliasTable::BuildBeta(ModelBase* model, int32_t id, 
+        int32_t num_threads, Barrier* barrier)
+    {
+        if (beta_builder_ == nullptr || 
+            num_threads > static_cast<int32_t>(beta_thread_mass_.size()))
+        {
+            Log::Fatal("Parallel beta row is not set for %d threads\n", 
+                num_threads);
+        }
+        int32_t begin = static_cast<int32_t>(
+            static_cast<int64_t>(num_topics_) * id / num_threads);
+        int32_t end = static_cast<int32_t>(
+            static_cast<int64_t>(num_topics_) * (id + 1) / num_threads);
+        SummaryRow summary_row = model->GetSummaryRow();
+        float mass = 0;
+        for (int32_t k = begin; k < end; ++k)
+        {
+            UpdateInvSummary(k, summary_row.At(k));
+            beta_proportion_[k] = beta_ * InvSummary(k);
+            mass += beta_proportion_[k];
+        }
+        beta_thread_mass_[id] = mass;
+        barrier->Wait();
+        mass = 0;
+        for (int32_t t = 0; t < num_threads; ++t)
+        {
+            mass += beta_thread_mass_[t];
+        }
+        beta_builder_->Build(beta_proportion_.data(), num_topics_, mass,
+            beta_height_, beta_kv_vector_, id, num_threads, 
+            [barrier]() { barrier->Wait(); });
+        if (id == 0) beta_mass_ = mass;
+    }
+
+    WordEntry& AliasTable::word_entry(int32_t word)
+    {
+        return table_index_->word_entry(word);
+    }
+
+    void AliasTable::Prefetch(int32_t word, const WordEntry& word_entry) const
+    {
+        _PREFETCH(&height_[word]);
+        _PREFETCH(&mass_[word]);
+        // The bucket is random, only the head of a row is certain to be 
+        // read. Sparse rows of small words fit in a few lines
+        const int32_t* kv_vector = memory_block_ + word_entry.begin_offset;
+        int32_t size = word_entry.is_dense ? 2 
+            : sparse_record_ints_ * num_buckets_[word];
+        if (size > kMaxPrefetchInts) size = kMaxPrefetchInts;
+        for (int32_t i = 0; i < size; i += 16)
+        {
+            _PREFETCH(kv_vector + i);
+        }
+    }
+
+    int32_t AliasTable::Propose(int32_t word, philox_rng& rng)
+    {
+        return Propose(word, table_index_->word_entry(word), rng);
+    }
+
+    int32_t AliasTable::Propose(int32_t word, const WordEntry& word_entry,
+        philox_rng& rng)
     {
-        WordEntry& word_entry = table_index_->word_entry(word);
         int32_t* kv_vector = memory_block_ + word_entry.begin_offset;
-        int32_t capacity = word_entry.capacity;
+        int32_t capacity = num_buckets_[word];
         if (word_entry.is_dense)
         {
+            if (stack_size_ > 0) return PopProposal(word, word_entry, rng);
             auto sample = rng.rand();
             int32_t idx = sample / height_[word];
             if (capacity <= idx) idx = capacity - 1;
@@ -133,16 +356,26 @@ namespace multiverso { namespace lightlda
             auto sample = rng.rand_double() * (mass_[word] + beta_mass_);
             if (sample < mass_[word])
             {
-                int32_t* idx_vector = kv_vector + 2 * word_entry.capacity;
                 auto n_kw_sample = rng.rand();
                 int32_t idx = n_kw_sample / height_[word];
                 if (capacity <= idx) idx = capacity - 1;
-                int32_t* p = kv_vector + 2 * idx;
-                int32_t k = *p++;
-                int32_t v = *p;
-                int32_t id = idx_vector[idx];
+                // One record holds all of the bucket
+                int32_t* p = kv_vector + sparse_record_ints_ * idx;
+                int32_t v = p[0];
+                int32_t id, alias;
+                if (sparse_record_ints_ == 2)
+                {
+                    uint32_t topics = static_cast<uint32_t>(p[1]);
+                    id = static_cast<int32_t>(topics & 0xffff);
+                    alias = static_cast<int32_t>(topics >> 16);
+                }
+                else
+                {
+                    id = p[1];
+                    alias = p[2];
+                }
                 int32_t m = -(n_kw_sample < v);
-                return (id & m) | (idx_vector[k] & ~m);
+                return (id & m) | (alias & ~m);
             }
             else
             {
@@ -158,123 +391,91 @@ namespace multiverso { namespace lightlda
         }
     }
 
-    void AliasTable::Clear()
-    {
-        delete q_w_proportion_;
-        q_w_proportion_ = nullptr;
-        delete q_w_proportion_int_;
-        q_w_proportion_int_ = nullptr;
-        delete L_;
-        L_ = nullptr;
-        delete H_;
-        H_ = nullptr;
-    }
-
-
-    void AliasTable::AliasMultinomialRNG(int32_t size, float mass, int32_t& height,
-        int32_t* kv_vector)
+    int32_t AliasTable::PopProposal(int32_t word, 
+        const WordEntry& word_entry, philox_rng& rng)
     {
-        int32_t mass_int = 0x7fffffff;
-        int32_t a_int = mass_int / size;
-        mass_int = a_int * size;
-        height = a_int;
-        int64_t mass_sum = 0;
-        for (int32_t i = 0; i < size; ++i)
+        // A thread may sample from several tables in turn, e.g. pipelined
+        // inference, and has stacks in each, as slots are per table
+        if (stacks_ == nullptr || stacks_serial_ != serial_)
         {
-            (*q_w_proportion_)[i] /= mass;
-            (*q_w_proportion_int_)[i] =
-                static_cast<int32_t>((*q_w_proportion_)[i] * mass_int);
-            mass_sum += (*q_w_proportion_int_)[i];
+            stacks_ = ThreadStacks();
+            stacks_serial_ = serial_;
         }
-        if (mass_sum > mass_int)
+        int32_t slot = stack_slot_[word];
+        if (slot >= static_cast<int32_t>(stacks_->top.size()))
         {
-            int32_t more = static_cast<int32_t>(mass_sum - mass_int);
-            int32_t id = 0;
-            for (int32_t i = 0; i < more;)
-            {
-                if ((*q_w_proportion_int_)[id] >= 1)
-                {
-                    --(*q_w_proportion_int_)[id];
-                    ++i;
-                }
-                id = (id + 1) % size;
-            }
+            int32_t num_stacks = std::max(slot + 1, 
+                num_stacks_.load(std::memory_order_relaxed));
+            stacks_->samples.resize(
+                static_cast<int64_t>(num_stacks) * stack_size_);
+            stacks_->version.resize(num_stacks, -1);
+            stacks_->top.resize(num_stacks, 0);
         }
-
-        if (mass_sum < mass_int)
+        int32_t* stack = stacks_->samples.data() 
+            + static_cast<int64_t>(slot) * stack_size_;
+        int32_t& top = stacks_->top[slot];
+        if (top == 0 || stacks_->version[slot] != version_[word])
         {
-            int32_t more = static_cast<int32_t>(mass_int - mass_sum);
-            int32_t id = 0;
-            for (int32_t i = 0; i < more; ++i)
-            {
-                ++(*q_w_proportion_int_)[id];
-                id = (id + 1) % size;
-            }
+            FillStack(word, word_entry, rng, stack);
+            top = stack_size_;
+            stacks_->version[slot] = version_[word];
         }
+        return stack[--top];
+    }
 
-        for (int32_t k = 0; k < size; ++k)
-        {
-            int32_t* p = kv_vector + 2 * k;
-            *p = k; ++p;
-            *p = (k + 1) * height;
-        }
-        int32_t L_head = 0, L_tail = 0, H_head = 0, H_tail = 0;
-        for (int32_t k = 0; k < size; ++k)
-        {
-            int32_t val = (*q_w_proportion_int_)[k];
-            if (val < height)
-            {
-                (*L_)[L_tail].first = k;
-                (*L_)[L_tail].second = val;
-                ++L_tail;
-            }
-            else
-            {
-                (*H_)[H_tail].first = k;
-                (*H_)[H_tail].second = val;
-                ++H_tail;
-            }
-        }
-        while (L_head != L_tail && H_head != H_tail)
-        {
-            auto& l_pl = (*L_)[L_head++];
-            auto& h_ph = (*H_)[H_head++];
-            int32_t* p = kv_vector + 2 * l_pl.first;
-            *p = h_ph.first; ++p;
-            *p = l_pl.first * height + l_pl.second;
+    AliasTable::ProposalStacks* AliasTable::ThreadStacks()
+    {
+        std::lock_guard<std::mutex> lock(stacks_mutex_);
+        std::unique_ptr<ProposalStacks>& stacks = 
+            thread_stacks_[std::this_thread::get_id()];
+        if (stacks == nullptr) stacks.reset(new ProposalStacks());
+        return stacks.get();
+    }
 
-            auto sum = h_ph.second + l_pl.second;
-            if (sum > 2 * height)
-            {
-                (*H_)[H_tail].first = h_ph.first;
-                (*H_)[H_tail].second = sum - height;
-                ++H_tail;
-            }
-            else
-            {
-                (*L_)[L_tail].first = h_ph.first;
-                (*L_)[L_tail].second = sum - height;
-                ++L_tail;
-            }
-        }
-        while (L_head != L_tail)
+    void AliasTable::AssignStack(int32_t word)
+    {
+        stack_slot_[word] = num_stacks_.fetch_add(1, 
+            std::memory_order_relaxed);
+        version_[word] = num_versions_.fetch_add(1, 
+            std::memory_order_relaxed);
+    }
+
+    void AliasTable::FillStack(int32_t word, const WordEntry& word_entry,
+        philox_rng& rng, int32_t* stack)
+    {
+        const int32_t* kv_vector = memory_block_ + word_entry.begin_offset;
+        const int32_t capacity = num_buckets_[word];
+        const int32_t height = height_[word];
+        const uint32_t* random = rng.Next(stack_size_);
+        // Same draws as Propose of a dense row, in one pass
+        for (int32_t i = 0; i < stack_size_; ++i)
         {
-            auto first = (*L_)[L_head].first;
-            auto second = (*L_)[L_head].second;
-            int32_t* p = kv_vector + 2 * first;
-            *p = first; ++p;
-            *p = first * height + second;
-            ++L_head;
+            int32_t sample = static_cast<int32_t>(random[i] & 0x7fffffff);
+            int32_t idx = std::min(sample / height, capacity - 1);
+            int32_t k = kv_vector[2 * idx];
+            int32_t v = kv_vector[2 * idx + 1];
+            int32_t m = -(sample < v);
+            stack[i] = (idx & m) | (k & ~m);
         }
-        while (H_head != H_tail)
+    }
+
+    void AliasTable::Clear()
+    {
+        delete q_w_proportion_;
+        q_w_proportion_ = nullptr;
+        delete topics_;
+        topics_ = nullptr;
+        delete kv_buffer_;
+        kv_buffer_ = nullptr;
+        delete builder_;
+        builder_ = nullptr;
+        // Stacks of other tables are freed with their table
+        if (stacks_ != nullptr && stacks_serial_ == serial_)
         {
-            auto first = (*H_)[H_head].first;
-            auto second = (*H_)[H_head].second;
-            int32_t* p = kv_vector + 2 * first;
-            *p = first; ++p;
-            *p = first * height + second;
-            ++H_head;
+            std::lock_guard<std::mutex> lock(stacks_mutex_);
+            thread_stacks_.erase(std::this_thread::get_id());
         }
+        stacks_ = nullptr;
     }
 } // namespace lightlda
 } // namespace multiverso
@@ -6,8 +6,11 @@
 #ifndef LIGHTLDA_ALIAS_TABLE_H_
 #define LIGHTLDA_ALIAS_TABLE_H_
 
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #if defined(_WIN32) || defined(_WIN64)
@@ -17,18 +20,28 @@
 #define _THREAD_LOCAL thread_local 
 #endif
 
-namespace multiverso { namespace lightlda
+namespace multiverso 
+{ 
+    class Barrier;
+
+namespace lightlda
 {
+    class AliasBuilder;
+    class ParallelAliasBuilder;
     class ModelBase;
-    class xorshift_rng;
+    class philox_rng;
     class AliasTableIndex;
+    struct WordEntry;
 
     /*!
      * \brief AliasTable is the storage for alias tables used for fast sampling
      *  from lightlda word proposal distribution. It optimize memory usage 
      *  through a hybrid storage by exploiting the sparsity of word proposal.
      *  AliasTable containes two part: 1) a memory pool to store the alias
-     *  2) an index table to access each row
+     *  2) an index table to access each row.
+     *  A dense row holds (alias, threshold) for each topic. A sparse row
+     *  holds one record per bucket, of threshold, own topic and alias topic,
+     *  so a proposal reads one place of the row
      */
     class AliasTable
     {
@@ -37,43 +50,207 @@ namespace multiverso { namespace lightlda
         ~AliasTable();
         /*!
          * \brief Set the table index. Must call this method before 
+         *  building rows of the index in iteration
          */
-        void Init(AliasTableIndex* table_index);
+        void Init(AliasTableIndex* table_index, int32_t iteration = 0);
         /*!
-         * \brief Build alias table for a word
+         * \brief Build alias table for a word. The beta row (word = -1) 
+         *  must be built first, since it also fills the reciprocal summary
+         *  table the word rows are built from
          * \param word word to bulid
          * \param model access
          * \return success of not
          */
         int Build(int word, ModelBase* model);
+        /*!
+         * \brief Build the beta row with num_threads threads, for very large
+         *  num_topics. Each thread calls with its id, and the row is ready
+         *  once they all return and synchronize on barrier
+         */
+        void BuildBeta(ModelBase* model, int32_t id, int32_t num_threads,
+            Barrier* barrier);
+        /*! \brief Whether the beta row is better built by BuildBeta */
+        static bool ParallelBeta(int32_t num_threads);
+        /*!
+         * \brief Build alias table for a word unless it is already built
+         *  since last Init. Safe to call from several threads, one of them 
+         *  builds and the others wait for it. Used with -lazy_alias, where
+         *  word rows are built on first use while sampling
+         */
+        void EnsureBuilt(int word, ModelBase* model);
+        /*!
+         * \brief Build alias table for a word, unless the row built in an
+         *  earlier iteration is still fresh by Config::alias_staleness and
+         *  Config::alias_max_age. MH steps correct the stale proposal
+         * \return whether the row is rebuilt
+         */
+        bool Refresh(int word, ModelBase* model);
+        /*!
+         * \brief Build the rows of the words [begin, end) of the index
+         *  given to the next Init, while the current index is sampled. The
+         *  rows must be in another part of the pool than the current ones,
+         *  and the words must not be sampled or updated until that Init.
+         *  Refresh keeps them after the Init
+         */
+        void Prebuild(AliasTableIndex* table_index, const int32_t* begin,
+            const int32_t* end, ModelBase* model);
+        /*!
+         * \brief Record a change of delta to the counts of word, which makes
+         *  its row staler. Concurrent records may get lost, as the drift is
+         *  only an estimate
+         */
+        void AddDrift(int word, int32_t delta);
+        /*! \brief Get 1 / (n_k + beta_sum) of topic k */
+        float InvSummary(int topic) const;
+        /*!
+         * \brief Refresh the reciprocal summary of a topic after its count
+         *  changed. Threads refresh concurrently; a stale entry only lags 
+         *  behind by the updates racing with it
+         */
+        void UpdateInvSummary(int topic, int64_t n_k);
         /*!
          * \brief sample from word proposal distribution
          * \param word word to sample
          * \param rng random number generator
          * \return sample proposed from the distribution
          */
-        int Propose(int word, xorshift_rng& rng);
-        /*! \brief Clear the alias table */
+        int Propose(int word, philox_rng& rng);
+        /*!
+         * \brief sample from word proposal distribution, with the index 
+         *  entry of word already resolved by word_entry
+         */
+        int Propose(int word, const WordEntry& word_entry, philox_rng& rng);
+        /*! \brief Get the index entry of a word */
+        WordEntry& word_entry(int word);
+        /*!
+         * \brief Prefetch what Propose reads for a word, called ahead of
+         *  sampling the word to hide the cache misses
+         */
+        void Prefetch(int word, const WordEntry& word_entry) const;
+        /*! \brief Clear the buffers of the calling thread */
         void Clear();
     private:
-        void AliasMultinomialRNG(int32_t size, float mass, int32_t& height,
-            int32_t* kv_vector);
+        /*!
+         * \brief Stacks of pre-drawn proposals of dense words, one stack of
+         *  Config::proposal_stack samples per word for each thread
+         */
+        struct ProposalStacks
+        {
+            std::vector<int32_t> samples;
+            /*! \brief version of the row each stack is drawn from */
+            std::vector<int32_t> version;
+            /*! \brief number of samples left in each stack */
+            std::vector<int32_t> top;
+        };
+        /*! \brief Allocate the build buffers of the calling thread */
+        void AllocBuffers();
+        /*! \brief Build the row of word in table_index at epoch */
+        void BuildWord(int32_t word, ModelBase* model, 
+            AliasTableIndex* table_index, int32_t epoch);
+        /*!
+         * \brief Whether the row of word is still fresh by 
+         *  Config::alias_staleness and Config::alias_max_age
+         */
+        bool Fresh(int32_t word) const;
+        /*! \brief Get the stacks of the calling thread in this table */
+        ProposalStacks* ThreadStacks();
+        /*!
+         * \brief Give dense word a stack among those of the current index,
+         *  and a new version, so no thread pops from an older stack
+         */
+        void AssignStack(int32_t word);
+        /*! \brief Pop a proposal of dense word, refilling its stack if empty */
+        int32_t PopProposal(int32_t word, const WordEntry& word_entry,
+            philox_rng& rng);
+        /*! \brief Draw a full stack of proposals of dense word */
+        void FillStack(int32_t word, const WordEntry& word_entry, 
+            philox_rng& rng, int32_t* stack);
+
         int* memory_block_;
         int64_t memory_size_;
         AliasTableIndex* table_index_;
 
         std::vector<int32_t> height_;
         std::vector<float> mass_;
+        /*!
+         * \brief number of buckets of the last build of each word. Kept
+         *  here rather than in the index, as a row may be reused under
+         *  another index of a shared layout
+         */
+        std::vector<int32_t> num_buckets_;
         int32_t beta_height_;
         float beta_mass_;
+        /*!
+         * \brief 1 / (n_k + beta_sum) for each topic k, written by the
+         *  samplers while others read it to build rows
+         */
+        std::unique_ptr<std::atomic<float>[]> inv_summary_;
+        /*!
+         * \brief build state of each word for EnsureBuilt, epoch_ * 2 when 
+         *  being built, epoch_ * 2 + 1 when built, anything else if not
+         */
+        std::unique_ptr<std::atomic<int32_t>[]> build_state_;
+        /*! \brief incremented by Init, outdating all the build states */
+        int32_t epoch_;
+        /*!
+         * \brief first epoch of the current run of Init on the same index,
+         *  or on indexes of a shared layout. Rows built before are 
+         *  overwritten by other slices
+         */
+        int32_t valid_epoch_;
+        /*! \brief iteration given to the last Init */
+        int32_t iteration_;
+        /*! \brief epoch of the last build of each word */
+        std::vector<int32_t> built_epoch_;
+        /*! \brief iteration of the last build of each word */
+        std::vector<int32_t> built_iteration_;
+        /*! \brief total count of each word at its last build */
+        std::vector<int32_t> built_count_;
+        /*! \brief absolute change of the counts of each word since built */
+        std::unique_ptr<std::atomic<int32_t>[]> drift_;
 
         int32_t* beta_kv_vector_;
+        /*! \brief builder, proportion and partial masses for BuildBeta */
+        std::unique_ptr<ParallelAliasBuilder> beta_builder_;
+        std::vector<float> beta_proportion_;
+        std::vector<float> beta_thread_mass_;
 
         // thread local storage used for building alias
         _THREAD_LOCAL static std::vector<float>* q_w_proportion_;
-        _THREAD_LOCAL static std::vector<int>* q_w_proportion_int_;
-        _THREAD_LOCAL static std::vector<std::pair<int, int>>* L_;
-        _THREAD_LOCAL static std::vector<std::pair<int, int>>* H_;
+        _THREAD_LOCAL static std::vector<int>* topics_;
+        _THREAD_LOCAL static std::vector<int>* kv_buffer_;
+        _THREAD_LOCAL static AliasBuilder* builder_;
+        _THREAD_LOCAL static ProposalStacks* stacks_;
+        /*! \brief serial_ of the table stacks_ belongs to */
+        _THREAD_LOCAL static int64_t stacks_serial_;
+
+        /*! \brief number of proposals in a stack, 0 if not pre-drawn */
+        int32_t stack_size_;
+        /*!
+         * \brief stack of each dense word, -1 if none yet. Slots are given
+         *  again from 0 for each index, so there are as many stacks as
+         *  dense words in a slice
+         */
+        std::vector<int32_t> stack_slot_;
+        std::atomic<int32_t> num_stacks_;
+        /*! \brief version of each dense word, outdating its older stacks */
+        std::vector<int32_t> version_;
+        std::atomic<int32_t> num_versions_;
+        /*! \brief stacks of each thread sampling from this table */
+        std::unordered_map<std::thread::id, 
+            std::unique_ptr<ProposalStacks> > thread_stacks_;
+        std::mutex stacks_mutex_;
+        /*! \brief unique id of the table, tables may share an address */
+        int64_t serial_;
+        static std::atomic<int64_t> num_tables_;
+
+        /*! \brief max number of ints of a row prefetched, 4 cache lines */
+        static const int32_t kMaxPrefetchInts = 64;
+        /*! \brief min num_topics to build the beta row in parallel */
+        static const int32_t kMinParallelTopics = 1 << 16;
+
+        /*! \brief ints of a bucket record in sparse rows, 2 or 3 */
+        int32_t sparse_record_ints_;
 
         int num_vocabs_;
         int num_topics_;
@@ -84,6 +261,24 @@ namespace multiverso { namespace lightlda
         AliasTable(const AliasTable&);
         void operator=(const AliasTable&);
     };
+
+    // -- inline functions definition area --------------------------------- //
+    inline float AliasTable::InvSummary(int topic) const
+    {
+        return inv_summary_[topic].load(std::memory_order_relaxed);
+    }
+    inline void AliasTable::UpdateInvSummary(int topic, int64_t n_k)
+    {
+        inv_summary_[topic].store(1.0f / (n_k + beta_sum_), 
+            std::memory_order_relaxed);
+    }
+    inline void AliasTable::AddDrift(int word, int32_t delta)
+    {
+        std::atomic<int32_t>& drift = drift_[word];
+        drift.store(drift.load(std::memory_order_relaxed) 
+            + (delta < 0 ? -delta : delta), std::memory_order_relaxed);
+    }
+    // -- inline functions definition area --------------------------------- //
 } // namespace lightlda
 } // namespace multiverso
 #endif // LIGHTLDA_ALIAS_TABLE_H_
@@ -1,6 +1,7 @@
 #include "common.h"
 
 #include <cstring>
+#include <ctime>
 
 namespace multiverso { namespace lightlda 
 {
@@ -11,6 +12,9 @@ namespace multiverso { namespace lightlda
     int32_t Config::num_topics = 100;
     int32_t Config::num_iterations = 100;
     int32_t Config::mh_steps = 2;
+    std::string Config::sampler = "exact";
+    int64_t Config::seed = -1;
+    std::string Config::perf_log = "";
     int32_t Config::num_servers = 1;
     int32_t Config::num_local_workers = 1;
     int32_t Config::num_aggregator = 1;
@@ -23,10 +27,22 @@ namespace multiverso { namespace lightlda
     bool Config::warm_start = false;
     bool Config::inference = false;
     bool Config::out_of_core = false;
+    bool Config::keep_doc_topic = false;
+    bool Config::lazy_alias = false;
+    float Config::alias_staleness = 0.0f;
+    int32_t Config::alias_max_age = 5;
+    int32_t Config::proposal_stack = 0;
+    bool Config::pipeline_alias = false;
+    bool Config::slice_arena = false;
+    int32_t Config::coalesce_docs = 0;
+    int32_t Config::local_summary = 0;
+    int32_t Config::hot_words = 0;
+    bool Config::local_training = false;
     int64_t Config::data_capacity = 1024 * kMB;
     int64_t Config::model_capacity = 512 * kMB;
     int64_t Config::delta_capacity = 256 * kMB;
     int64_t Config::alias_capacity = 512 * kMB;
+    int64_t Config::memory_budget = 0;
     // -- End: Config definitioin and defalut values ----------------------- //
 
     void Config::Init(int argc, char* argv[])
@@ -45,6 +61,9 @@ namespace multiverso { namespace lightlda
             if (strcmp(argv[i], "-num_topics") == 0) num_topics = atoi(argv[i + 1]);
             if (strcmp(argv[i], "-num_iterations") == 0) num_iterations = atoi(argv[i + 1]);
             if (strcmp(argv[i], "-mh_steps") == 0) mh_steps = atoi(argv[i + 1]);
+            if (strcmp(argv[i], "-sampler") == 0) sampler = std::string(argv[i + 1]);
+            if (strcmp(argv[i], "-seed") == 0) seed = atoll(argv[i + 1]);
+            if (strcmp(argv[i], "-perf_log") == 0) perf_log = std::string(argv[i + 1]);
             if (strcmp(argv[i], "-num_servers") == 0) num_servers = atoi(argv[i + 1]);
             if (strcmp(argv[i], "-num_local_workers") == 0) num_local_workers = atoi(argv[i + 1]);
             if (strcmp(argv[i], "-num_aggregator") == 0) num_aggregator = atoi(argv[i + 1]);
@@ -56,11 +75,24 @@ namespace multiverso { namespace lightlda
             if (strcmp(argv[i], "-server_file") == 0) server_file = std::string(argv[i + 1]);
             if (strcmp(argv[i], "-warm_start") == 0) warm_start = true;
             if (strcmp(argv[i], "-out_of_core") == 0) out_of_core = true;
+            if (strcmp(argv[i], "-keep_doc_topic") == 0) keep_doc_topic = true;
+            if (strcmp(argv[i], "-lazy_alias") == 0) lazy_alias = true;
+            if (strcmp(argv[i], "-alias_staleness") == 0) alias_staleness = static_cast<float>(atof(argv[i + 1]));
+            if (strcmp(argv[i], "-alias_max_age") == 0) alias_max_age = atoi(argv[i + 1]);
+            if (strcmp(argv[i], "-proposal_stack") == 0) proposal_stack = atoi(argv[i + 1]);
+            if (strcmp(argv[i], "-pipeline_alias") == 0) pipeline_alias = true;
+            if (strcmp(argv[i], "-slice_arena") == 0) slice_arena = true;
+            if (strcmp(argv[i], "-coalesce_docs") == 0) coalesce_docs = atoi(argv[i + 1]);
+            if (strcmp(argv[i], "-local_summary") == 0) local_summary = atoi(argv[i + 1]);
+            if (strcmp(argv[i], "-hot_words") == 0) hot_words = atoi(argv[i + 1]);
+            if (strcmp(argv[i], "-local_training") == 0) local_training = true;
             if (strcmp(argv[i], "-data_capacity") == 0) data_capacity = atoi(argv[i + 1]) * kMB;
             if (strcmp(argv[i], "-model_capacity") == 0) model_capacity = atoi(argv[i + 1]) * kMB;
             if (strcmp(argv[i], "-alias_capacity") == 0) alias_capacity = atoi(argv[i + 1]) * kMB;
             if (strcmp(argv[i], "-delta_capacity") == 0) delta_capacity = atoi(argv[i + 1]) * kMB;            
+            if (strcmp(argv[i], "-memory_budget") == 0) memory_budget = atoi(argv[i + 1]) * kMB;
         }
+        if (seed < 0) seed = static_cast<int64_t>(time(nullptr));
         Check();
     }
 
@@ -71,6 +103,11 @@ namespace multiverso { namespace lightlda
         printf("-num_topics <arg>        Number of topics. Default: 100\n");
         printf("-num_iterations <arg>    Number of iteratioins. Default: 100\n");
         printf("-mh_steps <arg>          Metropolis-hasting steps. Default: 2\n");
+        printf("-sampler <arg>           Sampling kernel, exact|approx|warp|batch\n");
+        printf("                         Default: exact\n");
+        printf("-seed <arg>              Seed of random numbers. Default: time\n");
+        printf("-perf_log <arg>          File to record likelihood and throughput\n");
+        printf("                         of every iteration. Default: none\n");
         printf("-alpha <arg>             Dirichlet prior alpha. Default: 0.1\n");
         printf("-beta <arg>              Dirichlet prior beta. Default: 0.01\n\n");
         printf("-num_blocks <arg>        Number of blocks in disk. Default: 1\n");
@@ -82,12 +119,46 @@ namespace multiverso { namespace lightlda
         printf("-num_aggregator <arg>    Number of local aggregation threads. Default: 1\n");
         printf("-server_file <arg>       Server endpoint file. Used by MPI-free version\n"); 
         printf("-warm_start              Warm start \n");
-        printf("-out_of_core             Use out of core computing \n\n");
+        printf("-out_of_core             Use out of core computing \n");
+        printf("-keep_doc_topic          Keep doc-topic counts in memory instead\n");
+        printf("                         of recounting for each slice \n");
+        printf("-lazy_alias              Build alias rows on first use while\n");
+        printf("                         sampling, instead of before \n");
+        printf("-alias_staleness <arg>   Reuse the alias row of a word across\n");
+        printf("                         iterations until this fraction of its\n");
+        printf("                         counts changed. Default: 0, no reuse\n");
+        printf("-alias_max_age <arg>     Max iterations an alias row is reused.\n");
+        printf("                         Default: 5\n");
+        printf("-proposal_stack <arg>    Pre-draw proposals of high tf words,\n");
+        printf("                         this many (<= 256) at a time per thread.\n");
+        printf("                         Default: 0, not pre-drawn\n");
+        printf("-slice_arena             Copy the word-topic rows of each slice\n");
+        printf("                         into one contiguous arena for sampling\n");
+        printf("-coalesce_docs <arg>     Sum the model updates of a thread over\n");
+        printf("                         this many documents, then send the net\n");
+        printf("                         changes. Default: 0, sent per token\n");
+        printf("-local_summary <arg>     Keep the summary updates of a thread\n");
+        printf("                         local, seen by its reads, and merge\n");
+        printf("                         them every this many documents.\n");
+        printf("                         Default: 0, merged as other updates\n");
+        printf("-hot_words <arg>         Give each thread a private copy of the\n");
+        printf("                         rows of this many words of highest tf\n");
+        printf("                         of a slice, merged at slice end.\n");
+        printf("                         Default: 0, no copy\n");
+        printf("-local_training          Keep the model in the memory of this\n");
+        printf("                         process, without parameter server.\n");
+        printf("                         Single process only\n");
+        printf("-pipeline_alias          Build the alias rows of the next slice\n");
+        printf("                         while the current one is sampled. Needs\n");
+        printf("                         -local_training\n\n");
         printf("-data_capacity <arg>     Memory pool size(MB) for data storage, \n");
         printf("                         should larger than the any data block\n");
         printf("-model_capacity <arg>    Memory pool size(MB) for local model cache\n");
         printf("-alias_capacity <arg>    Memory pool size(MB) for alias table \n");
         printf("-delta_capacity <arg>    Memory pool size(MB) for local delta cache\n");
+        printf("-memory_budget <arg>     Memory size(MB) for model, alias and delta\n");
+        printf("                         of a slice together, replacing the three\n");
+        printf("                         capacities above. Default: 0, not used\n");
         exit(0);
     }
 
@@ -98,6 +169,9 @@ namespace multiverso { namespace lightlda
         printf("-num_topics <arg>        Number of topics. Default: 100\n");
         printf("-num_iterations <arg>    Number of iteratioins. Default: 100\n");
         printf("-mh_steps <arg>          Metropolis-hasting steps. Default: 2\n");
+        printf("-sampler <arg>           Sampling kernel, exact|approx|warp|batch\n");
+        printf("                         Default: exact\n");
+        printf("-seed <arg>              Seed of random numbers. Default: time\n");
         printf("-alpha <arg>             Dirichlet prior alpha. Default: 0.1\n");
         printf("-beta <arg>              Dirichlet prior beta. Default: 0.01\n\n");
         printf("-num_blocks <arg>        Number of blocks in disk. Default: 1\n");
@@ -106,7 +180,22 @@ namespace multiverso { namespace lightlda
         printf("                         files generated by dump_block \n\n");
         printf("-num_local_workers <arg> Number of local training threads. Default: 4\n");
         printf("-warm_start              Warm start \n");
-        printf("-out_of_core             Use out of core computing \n\n");
+        printf("-out_of_core             Use out of core computing \n");
+        printf("-keep_doc_topic          Keep doc-topic counts in memory instead\n");
+        printf("                         of recounting for each slice \n");
+        printf("-lazy_alias              Build alias rows on first use while\n");
+        printf("                         sampling, instead of before \n");
+        printf("-alias_staleness <arg>   Reuse the alias row of a word across\n");
+        printf("                         iterations until this fraction of its\n");
+        printf("                         counts changed. Default: 0, no reuse\n");
+        printf("-alias_max_age <arg>     Max iterations an alias row is reused.\n");
+        printf("                         Default: 5\n");
+        printf("-proposal_stack <arg>    Pre-draw proposals of high tf words,\n");
+        printf("                         this many (<= 256) at a time per thread.\n");
+        printf("                         Default: 0, not pre-drawn\n");
+        printf("-pipeline_alias          Build the alias rows of the next block\n");
+        printf("                         while the current one is sampled, in a\n");
+        printf("                         second alias table \n\n");
         printf("-data_capacity <arg>     Memory pool size(MB) for data storage, \n");
         printf("                         should larger than the any data block\n");
         exit(0);
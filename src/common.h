@@ -18,8 +18,6 @@ namespace multiverso { namespace lightlda
     const int32_t kSummaryRow = 1;
     /*! \brief load factor for sparse hash table */
     const int32_t kLoadFactor = 2;
-    /*! \brief max length of a document */
-    const int32_t kMaxDocLength = 8192;
 
     // 
     typedef int64_t DocNumber;
@@ -40,6 +38,12 @@ namespace multiverso { namespace lightlda
         static int32_t num_iterations;
         /*! \brief number of metropolis-hastings steps */
         static int32_t mh_steps;
+        /*! \brief name of the metropolis-hastings sampling kernel */
+        static std::string sampler;
+        /*! \brief key of random number streams, taken from time if not set */
+        static int64_t seed;
+        /*! \brief file of per-iteration benchmark records, empty if none */
+        static std::string perf_log;
         /*! \brief number of servers for Multiverso setting */
         static int32_t num_servers;
         /*! \brief server endpoint file */
@@ -64,11 +68,65 @@ namespace multiverso { namespace lightlda
         static bool inference;
         /*! \brief option specity whether use out of core computation */
         static bool out_of_core;
+        /*! \brief option specify whether keep doc-topic counts in memory */
+        static bool keep_doc_topic;
+        /*! \brief option specify whether build alias rows on first use */
+        static bool lazy_alias;
+        /*!
+         * \brief changed fraction of a word's counts, beyond which its alias
+         *  row is rebuilt. 0 rebuilds all the rows every iteration
+         */
+        static float alias_staleness;
+        /*! \brief max number of iterations an alias row is reused */
+        static int32_t alias_max_age;
+        /*!
+         * \brief number of proposals of a dense word pre-drawn at a time by
+         *  each thread, 0 if not pre-drawn
+         */
+        static int32_t proposal_stack;
+        /*!
+         * \brief whether to build the alias rows of the next block while 
+         *  the current one is sampled, in a second table, in inference. In
+         *  training, the rows of the next slice, in a second half of the 
+         *  pool, with local_training only
+         */
+        static bool pipeline_alias;
+        /*!
+         * \brief in training, whether samplers read the word-topic rows of
+         *  a slice from a contiguous copy instead of the parameter cache
+         */
+        static bool slice_arena;
+        /*!
+         * \brief in training, number of documents over which each thread sums
+         *  its updates before sending them, 0 to send them per token
+         */
+        static int32_t coalesce_docs;
+        /*!
+         * \brief in training, number of documents over which each thread
+         *  keeps its summary updates local, reading them as corrections of
+         *  the shared row, 0 to merge them with the other updates
+         */
+        static int32_t local_summary;
+        /*!
+         * \brief in training, number of words of highest tf of a slice whose
+         *  rows each thread copies, 0 for none
+         */
+        static int32_t hot_words;
+        /*!
+         * \brief in training, whether the model is kept in the memory of the
+         *  process and shared by the trainers, instead of a parameter server
+         */
+        static bool local_training;
         /*! \brief memory capacity settings, for memory pools */
         static int64_t data_capacity;
         static int64_t model_capacity;
         static int64_t delta_capacity;
         static int64_t alias_capacity;
+        /*!
+         * \brief memory for model, alias and delta of a slice together, 
+         *  replacing their capacities if set, 0 if not set
+         */
+        static int64_t memory_budget;
     private:
         /*! \brief Print usage */
         static void PrintUsage();
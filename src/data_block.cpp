@@ -1,10 +1,14 @@
 #include "data_block.h"
+#include "doc_topic_counter.h"
 #include "document.h"
 #include "common.h"
+#include "meta.h"
 
 #include <multiverso/log.h>
 
+#include <algorithm>
 #include <fstream>
+#include <functional>
 
 #if defined(_WIN32) || defined(_WIN64)
 #include <Windows.h>
@@ -31,7 +35,9 @@ namespace
 namespace multiverso { namespace lightlda
 {
     DataBlock::DataBlock()
-        : has_read_(false), num_document_(0), corpus_size_(0), vocab_(nullptr)
+        : has_read_(false), num_document_(0), corpus_size_(0), vocab_(nullptr),
+        has_word_index_(false), has_slice_index_(false),
+        has_doc_topic_counts_(false)
     {
         max_num_document_ = Config::max_num_document;
         memory_block_size_ = Config::data_capacity / sizeof(int32_t);
@@ -93,6 +99,9 @@ namespace multiverso { namespace lightlda
 
         GenerateDocuments();
         has_read_ = true;
+        has_word_index_ = false;
+        has_slice_index_ = false;
+        has_doc_topic_counts_ = false;
     }
 
     void DataBlock::Write()
@@ -119,6 +128,145 @@ namespace multiverso { namespace lightlda
         has_read_ = false;
     }
 
+    void DataBlock::BuildWordIndex()
+    {
+        const LocalVocab& local_vocab = meta();
+        const int32_t* vocab_begin = local_vocab.begin(0);
+        const int32_t* vocab_end = local_vocab.end(local_vocab.num_slice() - 1);
+        int32_t vocab_size = static_cast<int32_t>(vocab_end - vocab_begin);
+
+        // Words of a document are sorted, so each run of a word is located 
+        // in the vocab by one search, starting from the previous run
+        auto for_each_run = [&](int32_t index, 
+            std::function<void(int32_t, int64_t, int32_t)> visit)
+        {
+            Document* doc = GetOneDoc(index);
+            const int32_t* p = vocab_begin;
+            int32_t i = 0;
+            while (i < doc->Size())
+            {
+                int32_t word = doc->Word(i);
+                int32_t j = i + 1;
+                while (j < doc->Size() && doc->Word(j) == word) ++j;
+                p = std::lower_bound(p, vocab_end, word);
+                if (p == vocab_end || *p != word)
+                {
+                    Log::Fatal("Word %d of doc %d not in local vocab\n", 
+                        word, index);
+                }
+                visit(static_cast<int32_t>(p - vocab_begin), 
+                    FirstSlot(index) + 2 * i, j - i);
+                i = j;
+            }
+        };
+
+        word_offset_.assign(vocab_size + 1, 0);
+        for (int32_t index = 0; index < num_document_; ++index)
+        {
+            for_each_run(index, [&](int32_t v, int64_t, int32_t count)
+            {
+                word_offset_[v + 1] += count;
+            });
+        }
+        for (int32_t v = 0; v < vocab_size; ++v)
+        {
+            word_offset_[v + 1] += word_offset_[v];
+        }
+        word_slots_.resize(word_offset_[vocab_size]);
+        std::vector<int64_t> cursor(word_offset_.begin(), word_offset_.end() - 1);
+        for (int32_t index = 0; index < num_document_; ++index)
+        {
+            for_each_run(index, [&](int32_t v, int64_t slot, int32_t count)
+            {
+                for (int32_t k = 0; k < count; ++k, slot += 2)
+                {
+                    word_slots_[cursor[v]++] = slot;
+                }
+            });
+        }
+        proposals_.assign(ProposalIndex(corpus_size_) + Config::mh_steps, -1);
+        has_word_index_ = true;
+    }
+
+    void DataBlock::BuildSliceIndex()
+    {
+        const LocalVocab& local_vocab = meta();
+        int32_t num_slice = local_vocab.num_slice();
+
+        // Words of a document are sorted, so its tokens of each slice are
+        // contiguous, and are found by one walk over the document
+        auto for_each_slice = [&](int32_t index,
+            std::function<void(int32_t, int32_t)> visit)
+        {
+            Document* doc = GetOneDoc(index);
+            int32_t cursor = 0;
+            for (int32_t slice = 0; slice < num_slice; ++slice)
+            {
+                if (cursor == doc->Size()) break;
+                int32_t lastword = local_vocab.LastWord(slice);
+                if (doc->Word(cursor) > lastword) continue;
+                visit(slice, cursor);
+                while (cursor < doc->Size() && doc->Word(cursor) <= lastword)
+                    ++cursor;
+            }
+        };
+
+        slice_offset_.assign(num_slice + 1, 0);
+        for (int32_t index = 0; index < num_document_; ++index)
+        {
+            for_each_slice(index, [&](int32_t slice, int32_t)
+            {
+                ++slice_offset_[slice + 1];
+            });
+        }
+        for (int32_t slice = 0; slice < num_slice; ++slice)
+        {
+            slice_offset_[slice + 1] += slice_offset_[slice];
+        }
+        slice_docs_.resize(slice_offset_[num_slice]);
+        slice_cursors_.resize(slice_offset_[num_slice]);
+        std::vector<int64_t> pos(slice_offset_.begin(), slice_offset_.end() - 1);
+        for (int32_t index = 0; index < num_document_; ++index)
+        {
+            for_each_slice(index, [&](int32_t slice, int32_t cursor)
+            {
+                slice_docs_[pos[slice]] = index;
+                slice_cursors_[pos[slice]++] = cursor;
+            });
+        }
+        has_slice_index_ = true;
+    }
+
+    void DataBlock::BuildDocTopicCounts()
+    {
+        // Loading and saving the counts costs about num_topics, it only 
+        // pays off for documents longer than that, which are also the ones
+        // to gain most. Memory is at most the size of the document
+        auto keep = [](Document* doc)
+        {
+            return doc->Size() >= Config::num_topics;
+        };
+        std::vector<int64_t> offset(num_document_ + 1, 0);
+        for (int32_t index = 0; index < num_document_; ++index)
+        {
+            Document* doc = GetOneDoc(index);
+            offset[index + 1] = offset[index] + (keep(doc) ?
+                1 + 2 * doc->MaxCountedTopics(Config::num_topics) : 0);
+        }
+        doc_topic_counts_.resize(offset[num_document_]);
+        DocTopicCounter counter(Config::num_topics);
+        for (int32_t index = 0; index < num_document_; ++index)
+        {
+            Document* doc = GetOneDoc(index);
+            doc->AttachTopicCounts(nullptr);
+            if (!keep(doc)) continue;
+            doc->GetDocTopicVector(counter);
+            doc->AttachTopicCounts(doc_topic_counts_.data() + offset[index]);
+            doc->SaveDocTopicVector(counter);
+        }
+        has_doc_topic_counts_ = true;
+    }
+
     void DataBlock::GenerateDocuments()
     {
         for (int32_t index = 0; index < num_document_; ++index)
@@ -43,6 +43,60 @@ namespace multiverso { namespace lightlda
          */
         Document* GetOneDoc(int32_t index);
 
+        /*!
+         * \brief Builds the word-major index of the block, which lists for 
+         *  each word of the local vocab the slots of its topic assignments.
+         *  Meta must be set before building. The index is dropped on Read
+         */
+        void BuildWordIndex();
+        bool HasWordIndex() const;
+        /*!
+         * \brief Gets the topic slots of a word, the word is given by its 
+         *  position in local vocab
+         * \param vocab_index position of the word in local vocab
+         * \param begin output, first slot of the word
+         * \param end output, last slot + 1 of the word
+         */
+        void WordSlots(int32_t vocab_index, const int64_t*& begin, 
+            const int64_t*& end) const;
+        /*! \brief Gets the topic assignment stored in a slot */
+        int32_t& Topic(int64_t slot);
+        /*! \brief Gets the slot of the first topic assignment of a document */
+        int64_t FirstSlot(int32_t index) const;
+        /*!
+         * \brief Gets the per-token proposal buffer, which holds mh_steps 
+         *  proposals for each token, addressed by ProposalIndex(slot). Reset 
+         *  to -1 (no proposal) whenever the word index is rebuilt
+         */
+        int32_t* proposals();
+        /*! \brief Maps a topic slot to its entry in proposal buffer */
+        static int64_t ProposalIndex(int64_t slot);
+
+        /*!
+         * \brief Builds the slice index of the block, which lists for each
+         *  slice the documents having tokens in it, with the position of 
+         *  their first such token. Meta must be set before building. The
+         *  index is dropped on Read
+         */
+        void BuildSliceIndex();
+        bool HasSliceIndex() const;
+        /*! \brief Gets the number of documents having tokens in a slice */
+        int32_t SliceSize(int32_t slice) const;
+        /*! \brief Gets the documents having tokens in a slice */
+        const int32_t* SliceDocs(int32_t slice) const;
+        /*! \brief Gets the first cursor in a slice of each of SliceDocs */
+        const int32_t* SliceCursors(int32_t slice) const;
+
+        /*!
+         * \brief Counts the topics of each long document once, and attaches
+         *  the counts to the document, so that samplers and evaluation update
+         *  and reuse them instead of counting tokens again. Samplers which 
+         *  change topics outside of LightDocSampler must not use it.
+         *  The counts are dropped on Read
+         */
+        void BuildDocTopicCounts();
+        bool HasDocTopicCounts() const;
+
         // mutator and accessor methods
         const LocalVocab& meta() const;
         void set_meta(const LocalVocab* local_vocab);
@@ -67,6 +121,21 @@ namespace multiverso { namespace lightlda
         const LocalVocab* vocab_;
         /*! \brief file name in disk */
         std::string file_name_;
+        /*! \brief word-major index, offset into word_slots_ for each word */
+        std::vector<int64_t> word_offset_;
+        /*! \brief word-major index, topic slots grouped by word */
+        std::vector<int64_t> word_slots_;
+        /*! \brief proposals kept for each token between passes */
+        std::vector<int32_t> proposals_;
+        bool has_word_index_;
+        /*! \brief slice index, offset into slice_docs_ for each slice */
+        std::vector<int64_t> slice_offset_;
+        std::vector<int32_t> slice_docs_;
+        std::vector<int32_t> slice_cursors_;
+        bool has_slice_index_;
+        /*! \brief topic counts attached to each document */
+        std::vector<int32_t> doc_topic_counts_;
+        bool has_doc_topic_counts_;
         // No copying allowed
         DataBlock(const DataBlock&);
         void operator=(const DataBlock&);
@@ -102,6 +171,46 @@ namespace multiverso { namespace lightlda
     // -- inline functions definition area --------------------------------- //
 
     inline bool DataBlock::HasLoad() const { return has_read_; }
+    inline bool DataBlock::HasWordIndex() const { return has_word_index_; }
+    inline bool DataBlock::HasSliceIndex() const { return has_slice_index_; }
+    inline int32_t DataBlock::SliceSize(int32_t slice) const
+    {
+        return static_cast<int32_t>(
+            slice_offset_[slice + 1] - slice_offset_[slice]);
+    }
+    inline const int32_t* DataBlock::SliceDocs(int32_t slice) const
+    {
+        return slice_docs_.data() + slice_offset_[slice];
+    }
+    inline const int32_t* DataBlock::SliceCursors(int32_t slice) const
+    {
+        return slice_cursors_.data() + slice_offset_[slice];
+    }
+    inline bool DataBlock::HasDocTopicCounts() const 
+    { 
+        return has_doc_topic_counts_; 
+    }
+    inline void DataBlock::WordSlots(int32_t vocab_index, 
+        const int64_t*& begin, const int64_t*& end) const
+    {
+        begin = word_slots_.data() + word_offset_[vocab_index];
+        end = word_slots_.data() + word_offset_[vocab_index + 1];
+    }
+    inline int32_t& DataBlock::Topic(int64_t slot)
+    {
+        return documents_buffer_[slot];
+    }
+    inline int64_t DataBlock::FirstSlot(int32_t index) const
+    {
+        return offset_buffer_[index] + 2;
+    }
+    inline int32_t* DataBlock::proposals() { return proposals_.data(); }
+    // topic slots of two tokens are at least 2 apart, so half of the slot is 
+    // unique for each token
+    inline int64_t DataBlock::ProposalIndex(int64_t slot) 
+    { 
+        return (slot >> 1) * Config::mh_steps; 
+    }
     inline Document* DataBlock::GetOneDoc(int32_t index)
     { 
         return documents_[index].get(); 
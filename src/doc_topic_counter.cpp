@@ -0,0 +1,100 @@
+#include "doc_topic_counter.h"
+
+#include <algorithm>
+
+namespace multiverso { namespace lightlda
+{
+    DocTopicCounter::DocTopicCounter(int32_t num_topics)
+        : num_topics_(num_topics), dense_(true), mask_(0), shift_(0)
+    {
+        counts_.resize(num_topics_, 0);
+    }
+
+    void DocTopicCounter::Reset(int32_t doc_size)
+    {
+        dense_ = (num_topics_ <= kDenseFactor * static_cast<int64_t>(doc_size));
+        if (dense_)
+        {
+            std::fill(counts_.begin(), counts_.end(), 0);
+            return;
+        }
+        // A document has at most doc_size distinct topics, keep the load
+        // factor of hash table no more than 0.5
+        int32_t capacity = 8, bits = 3;
+        while (capacity < 2 * doc_size)
+        {
+            capacity <<= 1;
+            ++bits;
+        }
+        if (static_cast<int32_t>(keys_.size()) < capacity)
+        {
+            keys_.resize(capacity);
+            values_.resize(capacity);
+        }
+        std::fill(keys_.begin(), keys_.begin() + capacity, kEmpty);
+        mask_ = capacity - 1;
+        shift_ = 32 - bits;
+    }
+
+    void DocTopicCounter::Erase(int32_t slot)
+    {
+        int32_t next = slot;
+        while (true)
+        {
+            next = (next + 1) & mask_;
+            int32_t key = keys_[next];
+            if (key == kEmpty) break;
+            int32_t home = static_cast<int32_t>(
+                (static_cast<uint32_t>(key) * 0x9E3779B1u) >> shift_);
+            // Move the entry back if its home is not in (slot, next]
+            if (((next - home) & mask_) >= ((next - slot) & mask_))
+            {
+                keys_[slot] = key;
+                values_[slot] = values_[next];
+                slot = next;
+            }
+        }
+        keys_[slot] = kEmpty;
+    }
+
+    DocTopicCounter::Iterator DocTopicCounter::GetIterator() const
+    {
+        return Iterator(this, dense_ ? num_topics_ : mask_ + 1);
+    }
+
+    DocTopicCounter::Iterator::Iterator(const DocTopicCounter* counter,
+        int32_t end) : counter_(counter), pos_(0), end_(end)
+    {
+        Skip();
+    }
+
+    int32_t DocTopicCounter::Iterator::Key() const
+    {
+        return counter_->dense_ ? pos_ : counter_->keys_[pos_];
+    }
+
+    int32_t DocTopicCounter::Iterator::Value() const
+    {
+        return counter_->dense_ ? counter_->counts_[pos_]
+            : counter_->values_[pos_];
+    }
+
+    void DocTopicCounter::Iterator::Next()
+    {
+        ++pos_;
+        Skip();
+    }
+
+    void DocTopicCounter::Iterator::Skip()
+    {
+        if (counter_->dense_)
+        {
+            while (pos_ < end_ && counter_->counts_[pos_] == 0) ++pos_;
+        }
+        else
+        {
+            while (pos_ < end_ && counter_->keys_[pos_] == kEmpty) ++pos_;
+        }
+    }
+} // namespace lightlda
+} // namespace multiverso
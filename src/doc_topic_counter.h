@@ -0,0 +1,120 @@
+/*!
+ * \file doc_topic_counter.h
+ * \brief Defines the topic counter of one document
+ */
+
+#ifndef LIGHTLDA_DOC_TOPIC_COUNTER_H_
+#define LIGHTLDA_DOC_TOPIC_COUNTER_H_
+
+#include <cstdint>
+#include <vector>
+
+namespace multiverso { namespace lightlda
+{
+    /*!
+     * \brief DocTopicCounter counts the topics of one document. The
+     *  representation is chosen per document when it is reset:
+     *  1) dense, an array of num_topics counts, for long documents
+     *  2) sparse, a linear probing hash table sized by the document length,
+     *  for short documents whose topics are a small fraction of num_topics.
+     *  A topic is removed from the hash table when its count drops to zero,
+     *  so the table never fills up and there is no limit on the length.
+     */
+    class DocTopicCounter
+    {
+    public:
+        explicit DocTopicCounter(int32_t num_topics);
+        /*!
+         * \brief Clear the counter, and choose the representation for a
+         *  document with doc_size tokens
+         */
+        void Reset(int32_t doc_size);
+        /*! \brief Get the count of topic */
+        int32_t At(int32_t topic) const;
+        /*! \brief Add delta to the count of topic */
+        void Add(int32_t topic, int32_t delta);
+        /*! \brief Whether the dense representation is in use */
+        bool IsDense() const { return dense_; }
+
+        /*! \brief iterates over the topics with nonzero count */
+        class Iterator
+        {
+        public:
+            bool HasNext() const { return pos_ < end_; }
+            int32_t Key() const;
+            int32_t Value() const;
+            void Next();
+        private:
+            friend class DocTopicCounter;
+            Iterator(const DocTopicCounter* counter, int32_t end);
+            /*! \brief move pos_ to the next nonzero entry */
+            void Skip();
+            const DocTopicCounter* counter_;
+            int32_t pos_;
+            int32_t end_;
+        };
+        Iterator GetIterator() const;
+    private:
+        /*! \brief Get the slot of topic, or the empty slot it would go */
+        int32_t Find(int32_t topic) const;
+        /*! \brief Remove the entry at slot, shifting back its followers */
+        void Erase(int32_t slot);
+
+        /*! \brief documents with num_topics <= kDenseFactor * size use dense */
+        static const int32_t kDenseFactor = 16;
+        static const int32_t kEmpty = -1;
+
+        int32_t num_topics_;
+        bool dense_;
+        /*! \brief dense counts, valid when dense_ */
+        std::vector<int32_t> counts_;
+        /*! \brief sparse hash table, valid when !dense_ */
+        std::vector<int32_t> keys_;
+        std::vector<int32_t> values_;
+        int32_t mask_;
+        int32_t shift_;
+
+        // No copying allowed
+        DocTopicCounter(const DocTopicCounter&);
+        void operator=(const DocTopicCounter&);
+    };
+
+    // -- inline functions definition area --------------------------------- //
+    inline int32_t DocTopicCounter::Find(int32_t topic) const
+    {
+        int32_t slot = static_cast<int32_t>(
+            (static_cast<uint32_t>(topic) * 0x9E3779B1u) >> shift_);
+        while (keys_[slot] != topic && keys_[slot] != kEmpty)
+            slot = (slot + 1) & mask_;
+        return slot;
+    }
+    inline int32_t DocTopicCounter::At(int32_t topic) const
+    {
+        if (dense_) return counts_[topic];
+        int32_t slot = Find(topic);
+        return keys_[slot] == kEmpty ? 0 : values_[slot];
+    }
+    inline void DocTopicCounter::Add(int32_t topic, int32_t delta)
+    {
+        if (dense_)
+        {
+            counts_[topic] += delta;
+            return;
+        }
+        int32_t slot = Find(topic);
+        if (keys_[slot] == kEmpty)
+        {
+            keys_[slot] = topic;
+            values_[slot] = delta;
+        }
+        else if ((values_[slot] += delta) == 0)
+        {
+            Erase(slot);
+        }
+    }
+    // -- inline functions definition area --------------------------------- //
+
+} // namespace lightlda
+} // namespace multiverso
+
+#endif // LIGHTLDA_DOC_TOPIC_COUNTER_H_
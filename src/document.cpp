@@ -1,24 +1,47 @@
 #include "document.h"
 
-#include <multiverso/row.h>
+#include "doc_topic_counter.h"
 
 namespace multiverso { namespace lightlda
 {
     Document::Document(int32_t* begin, int32_t* end)
-        : begin_(begin), end_(end), cursor_(*begin_)
+        : begin_(begin), end_(end), cursor_(*begin_), counts_(nullptr)
     {}
 
-    void Document::GetDocTopicVector(Row<int32_t>& topic_counter)
+    void Document::GetDocTopicVector(DocTopicCounter& topic_counter)
     {
+        topic_counter.Reset(Size());
+        if (counts_ != nullptr)
+        {
+            const int32_t* p = counts_ + 1;
+            for (int32_t i = 0; i < counts_[0]; ++i, p += 2)
+            {
+                topic_counter.Add(p[0], p[1]);
+            }
+            return;
+        }
         int32_t* p = begin_ + 2;
-        int32_t num = 0;
         while (p < end_)
         {
             topic_counter.Add(*p, 1);
             ++p; ++p;
-            if (++num == topic_counter.Capacity())
-                return;
         }
     }
+
+    void Document::SaveDocTopicVector(const DocTopicCounter& topic_counter)
+    {
+        if (counts_ == nullptr) return;
+        int32_t* p = counts_ + 1;
+        int32_t nnz = 0;
+        DocTopicCounter::Iterator iter = topic_counter.GetIterator();
+        while (iter.HasNext())
+        {
+            *p++ = iter.Key();
+            *p++ = iter.Value();
+            ++nnz;
+            iter.Next();
+        }
+        counts_[0] = nnz;
+    }
 } // namespace lightlda
 } // namespace multiverso
@@ -8,13 +8,10 @@
 
 #include "common.h"
 
-namespace multiverso
-{
-    template <typename T> class Row;
-}
-
 namespace multiverso { namespace lightlda
 {
+    class DocTopicCounter;
+
     /*!
      * \brief Document presents a document. Document doesn't own memory, but   
      *  would interpret a contiguous piece of extern memory as a document
@@ -34,16 +31,37 @@ namespace multiverso { namespace lightlda
         int32_t Word(int32_t index) const;
         /*! \brief Get the topic based on the index */
         int32_t Topic(int32_t index) const;
+        /*!
+         * \brief Get the end of the run of tokens sharing the word at index.
+         *  Words in a document are sorted, so a run holds all tokens of a word
+         */
+        int32_t RunEnd(int32_t index) const;
         /*! \brief Get the cursor */
         int32_t& Cursor();
         /*! \brief Set the topic based on the index */
         void SetTopic(int32_t index, int32_t topic);
-        /*! \brief Get the doc-topic vector */
-        void GetDocTopicVector(Row<int32_t>& vec);
+        /*!
+         * \brief Reset vec to the doc-topic vector of the document. Taken
+         *  from the attached topic counts if any, else counted from tokens
+         */
+        void GetDocTopicVector(DocTopicCounter& vec);
+        /*! \brief Store vec as the attached topic counts, if any */
+        void SaveDocTopicVector(const DocTopicCounter& vec);
+        /*!
+         * \brief Attach memory keeping the topic counts across slices and
+         *  iterations, with the format :
+         *  #nnz, topic1, count1, ..., topicn, countn.#
+         *  It must hold MaxCountedTopics(num_topics) pairs and be filled
+         *  with SaveDocTopicVector before use
+         */
+        void AttachTopicCounts(int32_t* counts);
+        /*! \brief Max number of distinct topics in the document */
+        int32_t MaxCountedTopics(int32_t num_topics) const;
     private:
         int32_t* begin_;
         int32_t* end_;
         int32_t& cursor_;
+        int32_t* counts_;
 
         // No copying allowed
         Document(const Document&);
@@ -63,7 +81,22 @@ namespace multiverso { namespace lightlda
     {
         return *(begin_ + 2 + index * 2);
     }
+    inline int32_t Document::RunEnd(int32_t index) const
+    {
+        int32_t word = Word(index);
+        int32_t size = Size();
+        while (++index < size && Word(index) == word);
+        return index;
+    }
     inline int32_t& Document::Cursor() { return cursor_; }
+    inline void Document::AttachTopicCounts(int32_t* counts)
+    {
+        counts_ = counts;
+    }
+    inline int32_t Document::MaxCountedTopics(int32_t num_topics) const
+    {
+        return Size() < num_topics ? Size() : num_topics;
+    }
     inline void Document::SetTopic(int32_t index, int32_t topic)
     {
         *(begin_ + 2 + index * 2) = topic;
@@ -3,11 +3,9 @@
 #include <cmath>
 
 #include "common.h"
+#include "doc_topic_counter.h"
 #include "document.h"
-#include "trainer.h"
-
-#include <multiverso/row.h>
-#include <multiverso/row_iter.h>
+#include "model.h"
 
 namespace
 {
@@ -34,15 +32,14 @@ namespace
 
 namespace multiverso { namespace lightlda
 { 
-    double Eval::ComputeOneDocLLH(Document* doc, Row<int32_t>& doc_topic_counter)
+    double Eval::ComputeOneDocLLH(Document* doc, DocTopicCounter& doc_topic_counter)
     {
         if (doc->Size() == 0) return 0.0;
         double one_doc_llh = LogGamma(Config::num_topics * Config::alpha)
             - Config::num_topics * LogGamma(Config::alpha);
         int32_t nonzero_num = 0;
-        doc_topic_counter.Clear();
         doc->GetDocTopicVector(doc_topic_counter);
-        Row<int32_t>::iterator iter = doc_topic_counter.Iterator();
+        DocTopicCounter::Iterator iter = doc_topic_counter.GetIterator();
         while (iter.HasNext())
         {
             one_doc_llh += LogGamma(iter.Value() + Config::alpha);
@@ -56,28 +53,26 @@ namespace multiverso { namespace lightlda
         return one_doc_llh;
     }
 
-    double Eval::ComputeOneWordLLH(int32_t word, Trainer* trainer)
+    double Eval::ComputeOneWordLLH(int32_t word, ModelBase* model)
     {
-        Row<int32_t>& params = trainer->GetRow<int32_t>(
-            kWordTopicTable, word);
-        if (params.NonzeroSize() == 0) return 0.0;
+        WordTopicRow params = model->GetWordTopicRow(word);
         double word_llh = 0.0;
         int32_t nonzero_num = 0;
-        RowIterator<int32_t> iter = params.Iterator();
-        while (iter.HasNext())
+        params.ForEach([&word_llh, &nonzero_num](int32_t, int32_t count)
         {
-            word_llh += LogGamma(iter.Value() + Config::beta);
+            word_llh += LogGamma(count + Config::beta);
             ++nonzero_num;
-            iter.Next();
-        }
+            return true;
+        });
+        if (nonzero_num == 0) return 0.0;
         word_llh += (Config::num_topics - nonzero_num)
             * LogGamma(Config::beta);
         return word_llh;
     }
 
-    double Eval::NormalizeWordLLH(Trainer* trainer)
+    double Eval::NormalizeWordLLH(ModelBase* model)
     {
-        Row<int64_t>& params = trainer->GetRow<int64_t>(kSummaryRow, 0);
+        SummaryRow params = model->GetSummaryRow();
         double llh = Config::num_topics *
             (LogGamma(Config::beta * Config::num_vocabs) -
             Config::num_vocabs * LogGamma(Config::beta));
@@ -8,16 +8,11 @@
 
 #include "common.h"
 
-namespace multiverso
-{
-    template <typename T>
-    class Row;
-}
-
 namespace multiverso { namespace lightlda
 {
     class Document;
-    class Trainer;
+    class DocTopicCounter;
+    class ModelBase;
 
     /*!
      * \brief Eval defines functions to compute the likelihood of lightlda
@@ -32,20 +27,20 @@ namespace multiverso { namespace lightlda
          * \param doc input document for evaluation
          */
         static double ComputeOneDocLLH(Document* doc, 
-            Row<int32_t>& doc_topic_counter);
+            DocTopicCounter& doc_topic_counter);
 
         /*!
          * \brief Compute word-likelihood for one word
          * \param word input word for evaluation
-         * \param trainer for multiverso parameter access 
+         * \param model for parameter access 
          */
-        static double ComputeOneWordLLH(int32_t word, Trainer* trainer);
+        static double ComputeOneWordLLH(int32_t word, ModelBase* model);
 
         /*!
          * \brief Compute normalization item for word-likelihood
-         * \param trainer for multiverso parameter access
+         * \param model for parameter access
          */
-        static double NormalizeWordLLH(Trainer* trainer);
+        static double NormalizeWordLLH(ModelBase* model);
     };
 } // namespace lightlda
 } // namespace multiverso
@@ -3,8 +3,11 @@
 #include "alias_table.h"
 #include "data_stream.h"
 #include "data_block.h"
+#include "doc_topic_counter.h"
 #include "document.h"
 #include "meta.h"
+#include "model.h"
+#include "slice_arena.h"
 #include "util.h"
 #include <vector>
 #include <iostream>
@@ -21,13 +24,21 @@ namespace multiverso { namespace lightlda
         {
             Config::Init(argc, argv);
             
-            AliasTable* alias_table = new AliasTable();
             Barrier* barrier = new Barrier(Config::num_local_workers);
             meta.Init();
+            // The alias table is sized by the schedule of meta
+            AliasTable* alias_table = new AliasTable();
+            SliceArena* arena = Config::slice_arena ? new SliceArena() : nullptr;
+            if (Config::local_training)
+            {
+                shared_model = new SharedModel(&meta, 
+                    Config::alias_staleness > 0 ? alias_table : nullptr);
+            }
             std::vector<TrainerBase*> trainers;
             for (int32_t i = 0; i < Config::num_local_workers; ++i)
             {
-                Trainer* trainer = new Trainer(alias_table, barrier, &meta);
+                Trainer* trainer = new Trainer(alias_table, barrier, &meta,
+                    arena, shared_model);
                 trainers.push_back(trainer);
             }
 
@@ -38,15 +49,33 @@ namespace multiverso { namespace lightlda
             config.server_endpoint_file = Config::server_file;
 
             Multiverso::Init(trainers, param_loader, config, &argc, &argv);
+            if (Config::local_training && Multiverso::TotalProcessCount() > 1)
+            {
+                Log::Fatal("-local_training runs in a single process, "
+                    "not %d\n", Multiverso::TotalProcessCount());
+            }
+            // Drift of alias rows only counts the updates of this process,
+            // the other processes are taken to change the counts as much
+            Config::alias_staleness /= Multiverso::TotalProcessCount();
 
             Log::ResetLogFile("LightLDA."
                 + std::to_string(clock()) + ".log");
+            Log::Info("Random seed = %lld\n", 
+                static_cast<long long>(Config::seed));
+            if (Config::pipeline_alias && !Config::local_training)
+            {
+                Log::Info("WARNING: -pipeline_alias needs -local_training, "
+                    "the rows of the next slice are not in the parameter "
+                    "cache while a slice is sampled\n");
+            }
 
             data_stream = CreateDataStream();
             InitMultiverso();
             Train();
 
             Multiverso::Close();
+            // The parameter server writes its own tables on close
+            if (shared_model != nullptr) shared_model->Dump();
             
             for (auto& trainer : trainers)
             {
@@ -59,6 +88,8 @@ namespace multiverso { namespace lightlda
             delete data_stream;
             delete barrier;
             delete alias_table;
+            delete arena;
+            delete shared_model;
         }
     private:
         static void Train()
@@ -96,15 +127,20 @@ namespace multiverso { namespace lightlda
         static void InitMultiverso()
         {
             Multiverso::BeginConfig();
-            CreateTable();
-            ConfigTable();
+            if (!Config::local_training)
+            {
+                CreateTable();
+                ConfigTable();
+            }
             Initialize();
             Multiverso::EndConfig();
         }
 
         static void Initialize()
         {
-            xorshift_rng rng;
+            // Stream -1, apart from the streams of the sampling threads
+            philox_rng rng(Config::seed,
+                philox_rng::StreamId(Multiverso::ProcessRank(), -1));
             for (int32_t block = 0; block < Config::num_blocks; ++block)
             {
                 data_stream->BeforeDataAccess();
@@ -124,14 +160,25 @@ namespace multiverso { namespace lightlda
                             // Init the latent variable
                             if (!Config::warm_start)
                                 doc->SetTopic(cursor, rng.rand_k(Config::num_topics));
-                            // Init the server table
-                            Multiverso::AddToServer<int32_t>(kWordTopicTable,
-                                doc->Word(cursor), doc->Topic(cursor), 1);
-                            Multiverso::AddToServer<int64_t>(kSummaryRow,
-                                0, doc->Topic(cursor), 1);
+                            // Init the server table, or the shared model
+                            if (shared_model != nullptr)
+                            {
+                                shared_model->AddWordTopicRow(
+                                    doc->Word(cursor), doc->Topic(cursor), 1);
+                                shared_model->AddSummaryRow(
+                                    doc->Topic(cursor), 1);
+                            }
+                            else
+                            {
+                                Multiverso::AddToServer<int32_t>(
+                                    kWordTopicTable, doc->Word(cursor),
+                                    doc->Topic(cursor), 1);
+                                Multiverso::AddToServer<int64_t>(kSummaryRow,
+                                    0, doc->Topic(cursor), 1);
+                            }
                         }
                     }
-                    Multiverso::Flush();
+                    if (shared_model == nullptr) Multiverso::Flush();
                 }
                 data_stream->EndDataAccess();
             }
@@ -139,7 +186,7 @@ namespace multiverso { namespace lightlda
 
         static void DumpDocTopic()
         {
-            Row<int32_t> doc_topic_counter(0, Format::Sparse, kMaxDocLength); 
+            DocTopicCounter doc_topic_counter(Config::num_topics);
             for (int32_t block = 0; block < Config::num_blocks; ++block)
             {
                 std::ofstream fout("doc_topic." + std::to_string(block));
@@ -148,10 +195,9 @@ namespace multiverso { namespace lightlda
                 for (int i = 0; i < data_block.Size(); ++i)
                 {
                     Document* doc = data_block.GetOneDoc(i);
-                    doc_topic_counter.Clear();
                     doc->GetDocTopicVector(doc_topic_counter);
                     fout << i << " ";  // doc id
-                    Row<int32_t>::iterator iter = doc_topic_counter.Iterator();
+                    DocTopicCounter::Iterator iter = doc_topic_counter.GetIterator();
                     while (iter.HasNext())
                     {
                         fout << " " << iter.Key() << ":" << iter.Value();
@@ -222,9 +268,12 @@ namespace multiverso { namespace lightlda
         static IDataStream* data_stream;
         /*! \brief training data meta information */
         static Meta meta;
+        /*! \brief model without parameter server, if local_training */
+        static SharedModel* shared_model;
     };
     IDataStream* LightLDA::data_stream = nullptr;
     Meta LightLDA::meta;
+    SharedModel* LightLDA::shared_model = nullptr;
 
 } // namespace lightlda
 } // namespace multiverso
@@ -1,9 +1,20 @@
 #include "meta.h"
 #include "common.h"
+#include "util.h"
 
+#include <algorithm>
 #include <fstream>
 #include <multiverso/log.h>
 
+namespace
+{
+    /*! \brief Get bytes in MB, for logs */
+    long long MB(int64_t bytes)
+    {
+        return static_cast<long long>(bytes / 1024 / 1024);
+    }
+}
+
 namespace multiverso { namespace lightlda
 {
     LocalVocab::LocalVocab() 
@@ -18,28 +29,73 @@ namespace multiverso { namespace lightlda
         }
     }
 
-    AliasTableIndex::AliasTableIndex()
-    {
-        index_map_.resize(Config::num_vocabs, -1);
-    }
+    VocabRank::VocabRank() : first_word_(0), size_(0) {}
 
-    WordEntry& AliasTableIndex::word_entry(int32_t word)
+    void VocabRank::Push(int32_t word)
     {
-        if (index_map_[word] == -1)
+        if (size_ == 0) first_word_ = word;
+        int64_t pos = static_cast<int64_t>(word) - first_word_;
+        if (size_ != 0)
         {
-            Log::Fatal("Fatal in alias index: word %d not exist\n", word);
+            // The word must follow the last word, the top bit of the last block
+            int64_t last_block = static_cast<int64_t>(blocks_.size()) - 1;
+            if (pos < 0 || (pos >> 6) < last_block || ((pos >> 6) == last_block
+                && (blocks_.back().bits >> (pos & 63)) != 0))
+            {
+                Log::Fatal("Fatal in vocab rank: word %d out of order\n", word);
+            }
+        }
+        // Blocks before the word's hold the words pushed so far
+        while (static_cast<int64_t>(blocks_.size()) <= (pos >> 6))
+        {
+            blocks_.push_back({ 0, size_ });
         }
-        return index_[index_map_[word]];
+        blocks_.back().bits |= 1ULL << (pos & 63);
+        ++size_;
+    }
+
+    void VocabRank::Clear()
+    {
+        blocks_.clear();
+        first_word_ = 0;
+        size_ = 0;
+    }
+
+    AliasTableIndex::AliasTableIndex(bool shared_layout)
+        : shared_layout_(shared_layout) {}
+
+    void AliasTableIndex::WordNotExist(int32_t word)
+    {
+        Log::Fatal("Fatal in alias index: word %d not exist\n", word);
     }
 
     void AliasTableIndex::PushWord(int32_t word,
         bool is_dense, int64_t begin_offset, int32_t capacity)
     {
-        index_map_[word] = static_cast<int>(index_.size());
+        rank_.Push(word);
         index_.push_back({ is_dense, begin_offset, capacity });
     }
 
-    Meta::Meta()
+    int32_t AliasTableIndex::SparseRecordInts()
+    {
+        return Config::num_topics <= (1 << 16) ? 2 : 3;
+    }
+
+    bool AliasTableIndex::IsDense(int32_t tf)
+    {
+        // A dense row has num_topics records of 2 ints, a sparse row at
+        // most tf records. Prefer sparse as long as it is no larger
+        return static_cast<int64_t>(tf) * SparseRecordInts() > 
+            static_cast<int64_t>(Config::num_topics) * 2;
+    }
+
+    int64_t AliasTableIndex::RowInts(int32_t tf)
+    {
+        return IsDense(tf) ? static_cast<int64_t>(Config::num_topics) * 2 :
+            static_cast<int64_t>(tf) * SparseRecordInts();
+    }
+
+    Meta::Meta() : shared_alias_layout_(false), next_slice_offset_(0)
     {
     }
 
@@ -119,11 +175,30 @@ namespace multiverso { namespace lightlda
         int64_t model_capacity = Config::model_capacity;
         int64_t alias_capacity = Config::alias_capacity;
         int64_t delta_capacity = Config::delta_capacity;
+        int64_t memory_budget = Config::memory_budget;
 
         int32_t model_thresh = Config::num_topics / (2 * kLoadFactor);
-        int32_t alias_thresh = (Config::num_topics * 2) / 3;
         int32_t delta_thresh = Config::num_topics / (4 * kLoadFactor);
 
+        // Every thread keeps a stack of proposals for each dense word of
+        // the slice, counted in with the alias rows
+        int64_t stack_bytes = 0;
+        if (Config::proposal_stack > 0)
+        {
+            int32_t stack_size = std::min(Config::proposal_stack,
+                philox_rng::kBufferSize);
+            stack_bytes = static_cast<int64_t>(Config::num_local_workers) *
+                (stack_size + 2) * sizeof(int32_t);
+        }
+
+        // Training with -pipeline_alias builds the rows of the next slice
+        // in the other half of the alias pool
+        int64_t alias_copies = 
+            Config::pipeline_alias && Config::local_training ? 2 : 1;
+
+        // Largest need of any slice, the pools are sized to it
+        int64_t max_model = 0, max_alias = 0, max_delta = 0, max_stack = 0;
+        int32_t total_slices = 0;
 
 		// Schedule for each data block
         for (int32_t i = 0; i < Config::num_blocks; ++i)
@@ -135,6 +210,7 @@ namespace multiverso { namespace lightlda
             int64_t model_offset = 0;
             int64_t alias_offset = 0;
             int64_t delta_offset = 0;
+            int64_t stack_offset = 0;
             for (int32_t j = 0; j < local_vocab.size_; ++j)
 			{
                 int32_t word = vocabs[j];
@@ -143,42 +219,122 @@ namespace multiverso { namespace lightlda
                 int32_t model_size = (tf > model_thresh) ?
                     Config::num_topics* sizeof(int32_t) :
                     tf * kLoadFactor * sizeof(int32_t);
+                // Without parameter server, there is no model cache or 
+                // delta pool, only alias rows are held per slice
+                if (Config::local_training) model_size = 0;
                 model_offset += model_size;
 
-                int32_t alias_size = (tf > alias_thresh) ?
-                    Config::num_topics * 2 * sizeof(int32_t) :
-                    tf * 3 * sizeof(int32_t);
+                int64_t alias_size = 
+                    AliasTableIndex::RowInts(tf) * sizeof(int32_t);
                 alias_offset += alias_size;
+                int64_t stack_size = 
+                    AliasTableIndex::IsDense(tf) ? stack_bytes : 0;
+                stack_offset += stack_size;
 
                 int32_t delta_size = (local_tf > delta_thresh) ?
                     Config::num_topics * sizeof(int32_t) :
                     local_tf * kLoadFactor * 2 * sizeof(int32_t);
+                if (Config::local_training) delta_size = 0;
                 delta_offset += delta_size;
 
-                if (model_offset > model_capacity ||
-                    alias_offset > alias_capacity ||
-                    delta_offset > delta_capacity)
+                bool exceed = memory_budget > 0 ?
+                    model_offset + alias_copies * alias_offset + 
+                        delta_offset + stack_offset > memory_budget :
+                    model_offset > model_capacity ||
+                    alias_copies * alias_offset + stack_offset > 
+                        alias_capacity ||
+                    delta_offset > delta_capacity;
+                // A word too large for the memory alone still takes a slice
+                if (exceed && j != local_vocab.slice_index_.back())
                 {
-                    Log::Info("Actual Model capacity: %d MB, Alias capacity: %d MB, Delta capacity: %dMB\n",
-                        model_offset/1024/1024, alias_offset/1024/1024, delta_offset/1024/1024);
+                    model_offset -= model_size;
+                    alias_offset -= alias_size;
+                    delta_offset -= delta_size;
+                    stack_offset -= stack_size;
+                    Log::Info("Actual Model capacity: %lld MB, Alias capacity: %lld MB, Delta capacity: %lld MB\n",
+                        MB(model_offset), MB(alias_offset), MB(delta_offset));
+                    max_model = std::max(max_model, model_offset);
+                    max_alias = std::max(max_alias, alias_offset);
+                    max_delta = std::max(max_delta, delta_offset);
+                    max_stack = std::max(max_stack, stack_offset);
                     local_vocab.slice_index_.push_back(j);
                     ++local_vocab.num_slices_;
                     model_offset = model_size;
                     alias_offset = alias_size;
                     delta_offset = delta_size;
+                    stack_offset = stack_size;
                 }
 			}
+            max_model = std::max(max_model, model_offset);
+            max_alias = std::max(max_alias, alias_offset);
+            max_delta = std::max(max_delta, delta_offset);
+            max_stack = std::max(max_stack, stack_offset);
             local_vocab.slice_index_.push_back(local_vocab.size_);
             ++local_vocab.num_slices_;
+            total_slices += local_vocab.num_slices_;
             Log::Info("INFO: block = %d, the number of slice = %d\n",
                 i, local_vocab.num_slices_);
 		}
+
+        // Alias rows outlive a slice only if each word keeps its own place
+        // in the pool over all the slices of all the blocks
+        if (Config::alias_staleness > 0 && total_slices > 1)
+        {
+            int64_t alias_total = 0;
+            std::vector<bool> placed(Config::num_vocabs, false);
+            for (int32_t i = 0; i < Config::num_blocks; ++i)
+            {
+                const LocalVocab& local_vocab = local_vocabs_[i];
+                for (int32_t j = 0; j < local_vocab.size_; ++j)
+                {
+                    int32_t word = local_vocab.vocabs_[j];
+                    if (placed[word]) continue;
+                    placed[word] = true;
+                    alias_total += 
+                        AliasTableIndex::RowInts(tf_[word]) * sizeof(int32_t);
+                }
+            }
+            int64_t alias_limit = (memory_budget > 0 ?
+                memory_budget - max_model - max_delta : alias_capacity) -
+                max_stack;
+            if (alias_total <= alias_limit)
+            {
+                shared_alias_layout_ = true;
+                max_alias = alias_total;
+            }
+            else
+            {
+                Log::Info("WARNING: -alias_staleness needs %lld MB of alias "
+                    "memory for %d slices, more than %lld MB, alias rows are "
+                    "rebuilt in every slice\n", MB(alias_total), total_slices,
+                    MB(alias_limit));
+                Config::alias_staleness = 0.0f;
+            }
+        }
+
+        // Words of a shared layout have their own place in any slice
+        if (alias_copies > 1 && !shared_alias_layout_)
+        {
+            next_slice_offset_ = max_alias / sizeof(int32_t);
+            max_alias *= alias_copies;
+        }
+        Config::alias_capacity = max_alias;
+        if (memory_budget > 0)
+        {
+            Config::model_capacity = max_model;
+            Config::delta_capacity = max_delta;
+        }
+        Log::Info("INFO: the number of slice = %d in %d blocks, Model capacity: "
+            "%lld MB, Alias capacity: %lld MB, Delta capacity: %lld MB, "
+            "Proposal stacks: %lld MB\n",
+            total_slices, Config::num_blocks, MB(Config::model_capacity),
+            MB(Config::alias_capacity), MB(Config::delta_capacity),
+            MB(max_stack));
     }
 
     void Meta::ModelSchedule4Inference()
     {
         Config::alias_capacity = 0;
-        int32_t alias_thresh = (Config::num_topics * 2) / 3;
         // Schedule for each data block
         for (int32_t i = 0; i < Config::num_blocks; ++i)
         {
@@ -192,10 +348,7 @@ namespace multiverso { namespace lightlda
             {
                 int32_t word = vocabs[j];
                 int32_t tf = tf_[word];
-                int32_t alias_size = (tf > alias_thresh) ?
-                    Config::num_topics * 2 * sizeof(int32_t) :
-                    tf * 3 * sizeof(int32_t);
-                alias_offset += alias_size;
+                alias_offset += AliasTableIndex::RowInts(tf) * sizeof(int32_t);
             }
             if(alias_offset > Config::alias_capacity)
             {
@@ -207,8 +360,10 @@ namespace multiverso { namespace lightlda
 
     void Meta::BuildAliasIndex()
     {
-        int32_t alias_thresh = (Config::num_topics * 2) / 3;
         alias_index_.resize(Config::num_blocks);
+        std::vector<int64_t> word_offset;
+        int64_t shared_offset = 0;
+        if (shared_alias_layout_) word_offset.resize(Config::num_vocabs, -1);
         // for each block
         for (int32_t i = 0; i < Config::num_blocks; ++i)
         {
@@ -217,23 +372,28 @@ namespace multiverso { namespace lightlda
             // for each slice
             for (int32_t j = 0; j < vocab.num_slice(); ++j)
             {
-                alias_index_[i][j] = new AliasTableIndex();
-                int64_t offset = 0;
+                alias_index_[i][j] = new AliasTableIndex(shared_alias_layout_);
+                int64_t offset = (j % 2) * next_slice_offset_;
                 for (const int32_t* p = vocab.begin(j);
                     p != vocab.end(j); ++p)
                 {
                     int32_t word = *p;
-                    bool is_dense = true;
-                    int32_t capacity = Config::num_topics;
-                    int64_t size = Config::num_topics * 2;
-                    if (tf(word) <= alias_thresh)
+                    bool is_dense = AliasTableIndex::IsDense(tf(word));
+                    int32_t capacity = is_dense ? Config::num_topics : tf(word);
+                    // The size of a row only depends on the global tf, so
+                    // a word fits the place it got in an earlier slice
+                    if (shared_alias_layout_)
                     {
-                        is_dense = false;
-                        capacity = tf(word);
-                        size = tf(word) * 3;
+                        if (word_offset[word] < 0)
+                        {
+                            word_offset[word] = shared_offset;
+                            shared_offset += 
+                                AliasTableIndex::RowInts(tf(word));
+                        }
+                        offset = word_offset[word];
                     }
                     alias_index_[i][j]->PushWord(word, is_dense, offset, capacity);
-                    offset += size;
+                    offset += AliasTableIndex::RowInts(tf(word));
                 }
             }
         }
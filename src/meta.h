@@ -10,6 +10,10 @@
 #include <vector>
 #include <cstdint>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 namespace multiverso { namespace lightlda
 {
     /*!
@@ -46,16 +50,69 @@ namespace multiverso { namespace lightlda
         int32_t capacity;
     };
 
+    /*!
+     * \brief VocabRank gives the position of a word in a sorted list of 
+     *  words, e.g. the words of a slice, a subset of [first word, last word].
+     *  The words are marked in a bitmap of that range. A word's position is
+     *  the number of marked words before it: the rank before its 64-bit
+     *  block, stored with the block, plus a popcount in the block. It takes
+     *  about 2 bits per word of the range.
+     */
+    class VocabRank
+    {
+    public:
+        VocabRank();
+        /*! \brief Add the next word of the list, words come in order */
+        void Push(int32_t word);
+        /*! \brief Get the position of word in the list, -1 if not in it */
+        int32_t Position(int32_t word) const;
+        /*! \brief Remove all the words */
+        void Clear();
+    private:
+        /*! \brief 64 words of the range, and the rank before them */
+        struct RankBlock
+        {
+            uint64_t bits;
+            int32_t rank;
+        };
+        static int32_t PopCount(uint64_t bits);
+
+        std::vector<RankBlock> blocks_;
+        int32_t first_word_;
+        int32_t size_;
+    };
+
+    /*! \brief AliasTableIndex locates the alias rows of the words of a slice */
     class AliasTableIndex
     {
     public:
-        AliasTableIndex();
+        /*!
+         * \brief shared_layout tells that a word has the same row in every
+         *  index, so rows built for another index stay valid
+         */
+        explicit AliasTableIndex(bool shared_layout);
         WordEntry& word_entry(int32_t word);
+        /*! \brief Add the next word of the slice, words come in order */
         void PushWord(int32_t word, bool is_dense,
             int64_t begin_offset, int32_t capacity);
+        /*!
+         * \brief Get the number of ints of a bucket record in sparse rows:
+         *  threshold and two 16-bit topics if topic ids fit in 16 bits,
+         *  otherwise threshold and two 32-bit topics
+         */
+        static int32_t SparseRecordInts();
+        /*! \brief Get whether the alias row of a word with tf is dense */
+        static bool IsDense(int32_t tf);
+        /*! \brief Get the number of ints of the alias row of a word */
+        static int64_t RowInts(int32_t tf);
+        /*! \brief Get whether a word has the same row in every index */
+        bool shared_layout() const { return shared_layout_; }
     private:
+        static void WordNotExist(int32_t word);
+
         std::vector<WordEntry> index_;
-        std::vector<int32_t> index_map_;
+        VocabRank rank_;
+        bool shared_layout_;
     };
 
     /*!
@@ -94,6 +151,10 @@ namespace multiverso { namespace lightlda
         std::vector<int32_t> local_tf_;
 
         std::vector<std::vector<AliasTableIndex*> > alias_index_;
+        /*! \brief whether each word has one alias row for all slices */
+        bool shared_alias_layout_;
+        /*! \brief offset in ints of the rows of odd slices, 0 if none */
+        int64_t next_slice_offset_;
         // No copying allowed
         Meta(const Meta&);
         void operator=(const Meta&);
@@ -113,6 +174,30 @@ namespace multiverso { namespace lightlda
     {
         return vocabs_ + slice_index_[slice + 1];
     }
+    inline int32_t VocabRank::PopCount(uint64_t bits)
+    {
+#if defined(_MSC_VER)
+        return static_cast<int32_t>(__popcnt64(bits));
+#else
+        return __builtin_popcountll(bits);
+#endif
+    }
+    inline int32_t VocabRank::Position(int32_t word) const
+    {
+        uint64_t pos = static_cast<uint64_t>(
+            static_cast<int64_t>(word) - first_word_);
+        if (pos >= static_cast<uint64_t>(blocks_.size()) * 64) return -1;
+        const RankBlock& block = blocks_[pos >> 6];
+        uint64_t bit = 1ULL << (pos & 63);
+        if (!(block.bits & bit)) return -1;
+        return block.rank + PopCount(block.bits & (bit - 1));
+    }
+    inline WordEntry& AliasTableIndex::word_entry(int32_t word)
+    {
+        int32_t position = rank_.Position(word);
+        if (position == -1) WordNotExist(word);
+        return index_[position];
+    }
     inline int32_t Meta::tf(int32_t word) const { return tf_[word]; }
     inline int32_t Meta::local_tf(int32_t word) const { return local_tf_[word]; }
     inline const LocalVocab& Meta::local_vocab(int32_t id) const
@@ -0,0 +1,131 @@
+#include "mh_batch.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define LIGHTLDA_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    using multiverso::lightlda::MHBatch;
+
+    typedef void (*AcceptFunc)(MHBatch& batch, int32_t size);
+
+    struct AcceptDispatch
+    {
+        AcceptFunc func;
+        const char* name;
+    };
+
+    // Products are taken in the same order as the scalar samplers, so all
+    // the versions give identical results
+    void AcceptScalar(MHBatch& b, int32_t begin, int32_t size)
+    {
+        for (int32_t i = begin; i < size; ++i)
+        {
+            float nominator = b.n_td_alpha[i] * b.n_tw_beta[i]
+                * b.n_s_beta_sum[i] * b.proposal_s[i];
+            float denominator = b.n_sd_alpha[i] * b.n_sw_beta[i]
+                * b.n_t_beta_sum[i] * b.proposal_t[i];
+            int32_t m = -(b.rejection[i] * denominator < nominator);
+            b.s[i] = (b.t[i] & m) | (b.s[i] & ~m);
+        }
+    }
+
+    void AcceptScalar(MHBatch& b, int32_t size)
+    {
+        AcceptScalar(b, 0, size);
+    }
+
+#ifdef LIGHTLDA_X86_DISPATCH
+    // Lanes beyond size are never loaded, they may hold denormals which 
+    // are slow to compute with
+    __attribute__((target("avx2")))
+    void AcceptAVX2(MHBatch& b, int32_t size)
+    {
+        int32_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            __m256 nominator = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(
+                _mm256_load_ps(b.n_td_alpha + i),
+                _mm256_load_ps(b.n_tw_beta + i)),
+                _mm256_load_ps(b.n_s_beta_sum + i)),
+                _mm256_load_ps(b.proposal_s + i));
+            __m256 denominator = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(
+                _mm256_load_ps(b.n_sd_alpha + i),
+                _mm256_load_ps(b.n_sw_beta + i)),
+                _mm256_load_ps(b.n_t_beta_sum + i)),
+                _mm256_load_ps(b.proposal_t + i));
+            __m256 accept = _mm256_cmp_ps(_mm256_mul_ps(
+                _mm256_load_ps(b.rejection + i), denominator), 
+                nominator, _CMP_LT_OQ);
+            __m256i t = _mm256_load_si256(
+                reinterpret_cast<const __m256i*>(b.t + i));
+            __m256i s = _mm256_load_si256(
+                reinterpret_cast<const __m256i*>(b.s + i));
+            _mm256_store_si256(reinterpret_cast<__m256i*>(b.s + i),
+                _mm256_blendv_epi8(s, t, _mm256_castps_si256(accept)));
+        }
+        AcceptScalar(b, i, size);
+    }
+
+    __attribute__((target("avx512f")))
+    void AcceptAVX512(MHBatch& b, int32_t size)
+    {
+        for (int32_t i = 0; i < size; i += 16)
+        {
+            __mmask16 lanes = (size - i >= 16) ? 0xFFFF 
+                : static_cast<__mmask16>((1 << (size - i)) - 1);
+            __m512 nominator = _mm512_mul_ps(_mm512_mul_ps(_mm512_mul_ps(
+                _mm512_maskz_load_ps(lanes, b.n_td_alpha + i),
+                _mm512_maskz_load_ps(lanes, b.n_tw_beta + i)),
+                _mm512_maskz_load_ps(lanes, b.n_s_beta_sum + i)),
+                _mm512_maskz_load_ps(lanes, b.proposal_s + i));
+            __m512 denominator = _mm512_mul_ps(_mm512_mul_ps(_mm512_mul_ps(
+                _mm512_maskz_load_ps(lanes, b.n_sd_alpha + i),
+                _mm512_maskz_load_ps(lanes, b.n_sw_beta + i)),
+                _mm512_maskz_load_ps(lanes, b.n_t_beta_sum + i)),
+                _mm512_maskz_load_ps(lanes, b.proposal_t + i));
+            __mmask16 accept = _mm512_mask_cmp_ps_mask(lanes, _mm512_mul_ps(
+                _mm512_maskz_load_ps(lanes, b.rejection + i), denominator),
+                nominator, _CMP_LT_OQ);
+            __m512i t = _mm512_load_si512(b.t + i);
+            __m512i s = _mm512_load_si512(b.s + i);
+            _mm512_store_si512(b.s + i, _mm512_mask_blend_epi32(accept, s, t));
+        }
+    }
+#endif
+
+    AcceptDispatch SelectAccept()
+    {
+#ifdef LIGHTLDA_X86_DISPATCH
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            return { AcceptAVX512, "avx512" };
+        if (__builtin_cpu_supports("avx2"))
+            return { AcceptAVX2, "avx2" };
+#endif
+        return { AcceptScalar, "scalar" };
+    }
+
+    const AcceptDispatch& GetAccept()
+    {
+        static const AcceptDispatch dispatch = SelectAccept();
+        return dispatch;
+    }
+}
+
+namespace multiverso { namespace lightlda
+{
+    void MHBatch::Accept(int32_t size)
+    {
+        GetAccept().func(*this, size);
+    }
+
+    const char* MHBatch::IsaName()
+    {
+        return GetAccept().name;
+    }
+} // namespace lightlda
+} // namespace multiverso
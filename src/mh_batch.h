@@ -0,0 +1,58 @@
+/*!
+ * \file mh_batch.h
+ * \brief Defines batched Metropolis-Hastings acceptance kernel
+ */
+
+#ifndef LIGHTLDA_MH_BATCH_H_
+#define LIGHTLDA_MH_BATCH_H_
+
+#include <cstdint>
+
+#if defined(_MSC_VER)
+#define _ALIGN(n) __declspec(align(n))
+#else
+#define _ALIGN(n) __attribute__((aligned(n)))
+#endif
+
+namespace multiverso { namespace lightlda
+{
+    /*!
+     * \brief MHBatch holds one Metropolis-Hastings step of several tokens in
+     *  struct-of-arrays layout. The caller gathers the counts of current
+     *  state s and proposal t of each token, then Accept evaluates all the
+     *  acceptance rates together and keeps s or moves to t
+     */
+    struct MHBatch
+    {
+        /*! \brief max number of tokens in a batch */
+        static const int32_t kSize = 16;
+
+        _ALIGN(64) float n_td_alpha[kSize];
+        _ALIGN(64) float n_sd_alpha[kSize];
+        _ALIGN(64) float n_tw_beta[kSize];
+        _ALIGN(64) float n_sw_beta[kSize];
+        _ALIGN(64) float n_t_beta_sum[kSize];
+        _ALIGN(64) float n_s_beta_sum[kSize];
+        _ALIGN(64) float proposal_t[kSize];
+        _ALIGN(64) float proposal_s[kSize];
+        _ALIGN(64) float rejection[kSize];
+        _ALIGN(64) int32_t t[kSize];
+        _ALIGN(64) int32_t s[kSize];
+
+        /*!
+         * \brief For each token i < size, s[i] = t[i] if rejection[i] < pi[i]
+         *  pi = n_td_alpha * n_tw_beta * n_s_beta_sum * proposal_s
+         *     / (n_sd_alpha * n_sw_beta * n_t_beta_sum * proposal_t)
+         *  evaluated without division, as rejection * denominator < nominator
+         *  Dispatched once to the widest instruction set supported by cpu.
+         *  All the lanes below size are computed, including tokens with
+         *  nothing to evaluate, which must hold finite values
+         */
+        void Accept(int32_t size);
+        /*! \brief Name of the instruction set Accept dispatched to */
+        static const char* IsaName();
+    };
+} // namespace lightlda
+} // namespace multiverso
+
+#endif // LIGHTLDA_MH_BATCH_H_
@@ -12,7 +12,9 @@
 #include <fstream>
 #include <sstream>
 
+#include "alias_table.h"
 #include "meta.h"
+#include "slice_arena.h"
 #include "trainer.h"
 
 #include <multiverso/log.h>
@@ -20,6 +22,44 @@
 
 namespace multiverso { namespace lightlda
 {
+    void WordTopicRow::Add(int32_t topic, int32_t delta) const
+    {
+        if (row_ != nullptr)
+        {
+            row_->Add(topic, delta);
+            return;
+        }
+        if (slots_ == nullptr)
+        {
+            counts_[topic].fetch_add(delta, std::memory_order_relaxed);
+            return;
+        }
+        // Keys are never removed, a topic keeps its slot once inserted
+        for (int32_t i = Hash(topic) & mask_; ; i = (i + 1) & mask_)
+        {
+            std::atomic<int32_t>& slot = slots_[2 * i];
+            int32_t key = slot.load(std::memory_order_relaxed);
+            if (key == kEmptyKey && slot.compare_exchange_strong(key, 
+                topic, std::memory_order_relaxed))
+            {
+                key = topic;
+            }
+            if (key == topic)
+            {
+                slots_[2 * i + 1].fetch_add(delta, std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+
+    int32_t WordTopicRow::NonzeroSize() const
+    {
+        if (row_ != nullptr) return row_->NonzeroSize();
+        int32_t size = 0;
+        ForEach([&size](int32_t, int32_t) { ++size; return true; });
+        return size;
+    }
+
     LocalModel::LocalModel(Meta * meta) : word_topic_table_(nullptr),
         summary_table_(nullptr), meta_(meta)
     {
@@ -226,30 +266,34 @@ namespace multiverso { namespace lightlda
         Log::Fatal("Not implemented yet\n");
     }
 
-    Row<int32_t>& LocalModel::GetWordTopicRow(integer_t word)
+    WordTopicRow LocalModel::GetWordTopicRow(integer_t word)
     {
-        return *(static_cast<Row<int32_t>*>(word_topic_table_->GetRow(word)));
+        return WordTopicRow(
+            static_cast<Row<int32_t>*>(word_topic_table_->GetRow(word)));
     }
 
-    Row<int64_t>& LocalModel::GetSummaryRow()
+    SummaryRow LocalModel::GetSummaryRow()
     {
-        return *(static_cast<Row<int64_t>*>(summary_table_->GetRow(0)));
+        return SummaryRow(
+            static_cast<Row<int64_t>*>(summary_table_->GetRow(0)));
     }
     
-    Row<int32_t>& PSModel::GetWordTopicRow(integer_t word_id)
+    WordTopicRow PSModel::GetWordTopicRow(integer_t word_id)
     {
-        return trainer_->GetRow<int32_t>(kWordTopicTable, word_id);
+        return WordTopicRow(
+            &trainer_->GetRow<int32_t>(kWordTopicTable, word_id));
     }
 
-    Row<int64_t>& PSModel::GetSummaryRow()
+    SummaryRow PSModel::GetSummaryRow()
     {
-        return trainer_->GetRow<int64_t>(kSummaryRow, 0);
+        return SummaryRow(&trainer_->GetRow<int64_t>(kSummaryRow, 0));
     }
 
     void PSModel::AddWordTopicRow(
         integer_t word_id, integer_t topic_id, int32_t delta)
     {
         trainer_->Add<int32_t>(kWordTopicTable, word_id, topic_id, delta);
+        if (alias_ != nullptr) alias_->AddDrift(word_id, delta);
     }
 
     void PSModel::AddSummaryRow(integer_t topic_id, int64_t delta)
@@ -257,5 +301,352 @@ namespace multiverso { namespace lightlda
         trainer_->Add<int64_t>(kSummaryRow, 0, topic_id, delta);
     }
 
+    SharedModel::SharedModel(Meta* meta, AliasTable* alias)
+        : alias_(alias), offset_(Config::num_vocabs, -1),
+        slots_(Config::num_vocabs, 0),
+        summary_(new std::atomic<int64_t>[Config::num_topics])
+    {
+        int64_t size = 0;
+        for (int32_t word = 0; word < Config::num_vocabs; ++word)
+        {
+            if (meta->tf(word) == 0) continue;
+            offset_[word] = size;
+            slots_[word] = SliceArena::Slots(meta->tf(word), 
+                meta->local_tf(word));
+            size += slots_[word] == 0 ? Config::num_topics : 2 * slots_[word];
+        }
+        memory_.reset(new std::atomic<int32_t>[size]);
+        for (int32_t word = 0; word < Config::num_vocabs; ++word)
+        {
+            if (offset_[word] < 0) continue;
+            std::atomic<int32_t>* memory = memory_.get() + offset_[word];
+            int32_t slots = slots_[word];
+            if (slots == 0)
+            {
+                for (int32_t k = 0; k < Config::num_topics; ++k)
+                    memory[k].store(0, std::memory_order_relaxed);
+            }
+            for (int32_t k = 0; k < slots; ++k)
+            {
+                memory[2 * k].store(WordTopicRow::kEmptyKey, 
+                    std::memory_order_relaxed);
+                memory[2 * k + 1].store(0, std::memory_order_relaxed);
+            }
+        }
+        for (int32_t k = 0; k < Config::num_topics; ++k)
+            summary_[k].store(0, std::memory_order_relaxed);
+        Log::Info("Shared model size: %lld MB\n",
+            static_cast<long long>(size * sizeof(int32_t) / 1024 / 1024));
+    }
+
+    void SharedModel::Compact(const LocalVocab& local_vocab, int32_t slice,
+        int32_t id, int32_t num_threads)
+    {
+        std::vector<std::pair<int32_t, int32_t>> topics;
+        for (const int32_t* pword = local_vocab.begin(slice) + id;
+            pword < local_vocab.end(slice); pword += num_threads)
+        {
+            int32_t slots = slots_[*pword];
+            if (slots == 0) continue;
+            std::atomic<int32_t>* memory = memory_.get() + offset_[*pword];
+            topics.clear();
+            for (int32_t k = 0; k < slots; ++k)
+            {
+                int32_t topic = memory[2 * k].load(std::memory_order_relaxed);
+                int32_t count = memory[2 * k + 1].load(std::memory_order_relaxed);
+                if (count != 0) topics.push_back(std::make_pair(topic, count));
+                memory[2 * k].store(WordTopicRow::kEmptyKey, 
+                    std::memory_order_relaxed);
+                memory[2 * k + 1].store(0, std::memory_order_relaxed);
+            }
+            WordTopicRow row(memory, slots - 1);
+            for (auto& topic : topics) row.Add(topic.first, topic.second);
+        }
+    }
+
+    void SharedModel::Dump()
+    {
+        std::string word_topic_name = "server_0_table_" 
+            + std::to_string(kWordTopicTable) + ".model";
+        std::string summary_name = "server_0_table_"
+            + std::to_string(kSummaryRow) + ".model";
+        std::ofstream word_topic_file(word_topic_name);
+        std::ofstream summary_file(summary_name);
+        if (!word_topic_file.good() || !summary_file.good())
+        {
+            Log::Fatal("Failed to open model files %s and %s\n",
+                word_topic_name.c_str(), summary_name.c_str());
+        }
+        for (int32_t word = 0; word < Config::num_vocabs; ++word)
+        {
+            if (offset_[word] < 0) continue;
+            WordTopicRow row = GetWordTopicRow(word);
+            if (row.NonzeroSize() == 0) continue;
+            word_topic_file << word;
+            row.ForEach([&word_topic_file](int32_t topic, int32_t count)
+            {
+                word_topic_file << " " << topic << ":" << count;
+                return true;
+            });
+            word_topic_file << "\n";
+        }
+        summary_file << 0;
+        for (int32_t k = 0; k < Config::num_topics; ++k)
+        {
+            int64_t count = summary_[k].load(std::memory_order_relaxed);
+            if (count != 0) summary_file << " " << k << ":" << count;
+        }
+        summary_file << "\n";
+        Log::Info("Dumped model to %s and %s\n", word_topic_name.c_str(),
+            summary_name.c_str());
+    }
+
+    WordTopicRow SharedModel::GetWordTopicRow(integer_t word_id)
+    {
+        int64_t offset = offset_[word_id];
+        if (offset < 0) Log::Fatal("Word %d is not in the model\n", word_id);
+        std::atomic<int32_t>* memory = memory_.get() + offset;
+        int32_t slots = slots_[word_id];
+        if (slots == 0) return WordTopicRow(memory);
+        return WordTopicRow(memory, slots - 1);
+    }
+
+    SummaryRow SharedModel::GetSummaryRow()
+    {
+        return SummaryRow(summary_.get());
+    }
+
+    void SharedModel::AddWordTopicRow(
+        integer_t word_id, integer_t topic_id, int32_t delta)
+    {
+        GetWordTopicRow(word_id).Add(topic_id, delta);
+        if (alias_ != nullptr) alias_->AddDrift(word_id, delta);
+    }
+
+    void SharedModel::AddSummaryRow(integer_t topic_id, int64_t delta)
+    {
+        summary_[topic_id].fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    WordTopicRow ArenaModel::GetWordTopicRow(integer_t word_id)
+    {
+        return arena_->row(word_id);
+    }
+
+    SummaryRow ArenaModel::GetSummaryRow()
+    {
+        return model_->GetSummaryRow();
+    }
+
+    void ArenaModel::AddWordTopicRow(
+        integer_t word_id, integer_t topic_id, int32_t delta)
+    {
+        arena_->row(word_id).Add(topic_id, delta);
+    }
+
+    void ArenaModel::AddSummaryRow(integer_t topic_id, int64_t delta)
+    {
+        model_->AddSummaryRow(topic_id, delta);
+    }
+
+    DeltaModel::DeltaModel(ModelBase* model, AliasTable* alias, 
+        bool buffer_words)
+        : model_(model), alias_(alias), buffer_words_(buffer_words),
+        summary_delta_(Config::num_topics, 0)
+    {
+        if (buffer_words_)
+        {
+            keys_.resize(kCapacity, -1);
+            deltas_.resize(kCapacity, 0);
+            used_.reserve(kCapacity / 2);
+        }
+    }
+
+    bool DeltaModel::Enabled()
+    {
+        return Config::coalesce_docs > 0 || Config::local_summary > 0;
+    }
+
+    WordTopicRow DeltaModel::GetWordTopicRow(integer_t word_id)
+    {
+        return model_->GetWordTopicRow(word_id);
+    }
+
+    SummaryRow DeltaModel::GetSummaryRow()
+    {
+        return SummaryRow(model_->GetSummaryRow(), summary_delta_.data());
+    }
+
+    void DeltaModel::AddWordTopicRow(
+        integer_t word_id, integer_t topic_id, int32_t delta)
+    {
+        if (!buffer_words_)
+        {
+            model_->AddWordTopicRow(word_id, topic_id, delta);
+            return;
+        }
+        int64_t key = (static_cast<int64_t>(word_id) << 32) | 
+            static_cast<uint32_t>(topic_id);
+        // Fibonacci hashing, the high bits mix both word and topic
+        int32_t i = static_cast<int32_t>((static_cast<uint64_t>(key) *
+            0x9E3779B97F4A7C15ull) >> (64 - kCapacityBits));
+        while (keys_[i] != key && keys_[i] != -1) i = (i + 1) & (kCapacity - 1);
+        if (keys_[i] == -1)
+        {
+            keys_[i] = key;
+            used_.push_back(i);
+        }
+        deltas_[i] += delta;
+        if (static_cast<int32_t>(used_.size()) >= kCapacity / 2) FlushWords();
+    }
+
+    void DeltaModel::AddSummaryRow(integer_t topic_id, int64_t delta)
+    {
+        if (summary_delta_[topic_id] == 0) summary_touched_.push_back(topic_id);
+        summary_delta_[topic_id] += delta;
+    }
+
+    void DeltaModel::Flush()
+    {
+        FlushWords();
+        FlushSummary();
+        model_->Flush();
+    }
+
+    void DeltaModel::FlushWords()
+    {
+        for (int32_t i : used_)
+        {
+            if (deltas_[i] != 0)
+            {
+                model_->AddWordTopicRow(static_cast<integer_t>(keys_[i] >> 32),
+                    static_cast<integer_t>(keys_[i] & 0xffffffff), deltas_[i]);
+                deltas_[i] = 0;
+            }
+            keys_[i] = -1;
+        }
+        used_.clear();
+    }
+
+    void DeltaModel::FlushSummary()
+    {
+        // A topic back to zero delta may be listed twice
+        for (int32_t k : summary_touched_)
+        {
+            if (summary_delta_[k] != 0)
+            {
+                model_->AddSummaryRow(k, summary_delta_[k]);
+                summary_delta_[k] = 0;
+                if (alias_ != nullptr)
+                    alias_->UpdateInvSummary(k, model_->GetSummaryRow().At(k));
+            }
+        }
+        summary_touched_.clear();
+    }
+
+    ReplicaModel::ReplicaModel(ModelBase* model, int32_t num_words)
+        : model_(model), num_words_(num_words), mask_(0),
+        counts_(new std::atomic<int32_t>[
+            static_cast<int64_t>(num_words) * Config::num_topics]),
+        delta_(static_cast<int64_t>(num_words) * Config::num_topics, 0)
+    {
+        words_.reserve(num_words_);
+        int32_t capacity = 1;
+        while (capacity < 2 * num_words_) capacity <<= 1;
+        table_.resize(capacity, -1);
+        mask_ = capacity - 1;
+    }
+
+    void ReplicaModel::Load(const LocalVocab& local_vocab, int32_t slice,
+        Meta* meta)
+    {
+        std::fill(table_.begin(), table_.end(), -1);
+        words_.assign(local_vocab.begin(slice), local_vocab.end(slice));
+        if (static_cast<int32_t>(words_.size()) > num_words_)
+        {
+            std::partial_sort(words_.begin(), words_.begin() + num_words_,
+                words_.end(), [meta](int32_t a, int32_t b)
+            {
+                return meta->tf(a) > meta->tf(b);
+            });
+            words_.resize(num_words_);
+        }
+        for (int32_t index = 0; index < static_cast<int32_t>(words_.size());
+            ++index)
+        {
+            int32_t word = words_[index];
+            uint32_t hash = static_cast<uint32_t>(word) * 2654435761u;
+            int32_t i = hash & mask_;
+            while (table_[i] != -1) i = (i + 1) & mask_;
+            table_[i] = index;
+
+            std::atomic<int32_t>* counts = counts_.get() + 
+                static_cast<int64_t>(index) * Config::num_topics;
+            for (int32_t k = 0; k < Config::num_topics; ++k)
+                counts[k].store(0, std::memory_order_relaxed);
+            model_->GetWordTopicRow(word).ForEach(
+                [counts](int32_t topic, int32_t count)
+            {
+                counts[topic].store(count, std::memory_order_relaxed);
+                return true;
+            });
+        }
+    }
+
+    WordTopicRow ReplicaModel::GetWordTopicRow(integer_t word_id)
+    {
+        int32_t index = Find(word_id);
+        if (index == -1) return model_->GetWordTopicRow(word_id);
+        return WordTopicRow(counts_.get() + 
+            static_cast<int64_t>(index) * Config::num_topics);
+    }
+
+    SummaryRow ReplicaModel::GetSummaryRow()
+    {
+        return model_->GetSummaryRow();
+    }
+
+    void ReplicaModel::AddWordTopicRow(
+        integer_t word_id, integer_t topic_id, int32_t delta)
+    {
+        int32_t index = Find(word_id);
+        if (index == -1)
+        {
+            model_->AddWordTopicRow(word_id, topic_id, delta);
+            return;
+        }
+        // Only this thread writes the copy, no atomic add is needed
+        int64_t offset = static_cast<int64_t>(index) * Config::num_topics
+            + topic_id;
+        std::atomic<int32_t>& count = counts_[offset];
+        count.store(count.load(std::memory_order_relaxed) + delta,
+            std::memory_order_relaxed);
+        delta_[offset] += delta;
+    }
+
+    void ReplicaModel::AddSummaryRow(integer_t topic_id, int64_t delta)
+    {
+        model_->AddSummaryRow(topic_id, delta);
+    }
+
+    void ReplicaModel::Flush()
+    {
+        for (int32_t index = 0; index < static_cast<int32_t>(words_.size());
+            ++index)
+        {
+            int32_t* delta = delta_.data() + 
+                static_cast<int64_t>(index) * Config::num_topics;
+            for (int32_t k = 0; k < Config::num_topics; ++k)
+            {
+                if (delta[k] != 0)
+                {
+                    model_->AddWordTopicRow(words_[index], k, delta[k]);
+                    delta[k] = 0;
+                }
+            }
+        }
+        model_->Flush();
+    }
+
 } // namespace lightlda
 } // namespace multiverso
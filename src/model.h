@@ -6,32 +6,105 @@
 #ifndef LIGHTLDA_MODEL_H_
 #define LIGHTLDA_MODEL_H_
 
+#include <atomic>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "common.h"
 #include <multiverso/meta.h>
+#include <multiverso/row.h>
 
 namespace multiverso 
 { 
-    template<typename T> class Row;
     class Table;
      
 namespace lightlda
 {
+    class AliasTable;
+    class LocalVocab;
     class Meta;
+    class SliceArena;
     class Trainer;
 
+    /*!
+     * \brief WordTopicRow is a view of the topic counts of a word: a row of
+     *  a multiverso table, or a row of a SliceArena, which is num_topics
+     *  dense counts or an open addressing table of slots, each a topic
+     *  followed by its count, read together
+     */
+    class WordTopicRow
+    {
+    public:
+        WordTopicRow();
+        explicit WordTopicRow(Row<int32_t>* row);
+        /*! \brief dense row of SliceArena */
+        explicit WordTopicRow(std::atomic<int32_t>* counts);
+        /*! \brief sparse row of SliceArena, of mask + 1 slots */
+        WordTopicRow(std::atomic<int32_t>* slots, int32_t mask);
+        /*! \brief Get the count of topic */
+        int32_t At(int32_t topic) const;
+        /*! \brief Add delta to the count of topic */
+        void Add(int32_t topic, int32_t delta) const;
+        /*! \brief Get the number of topics with nonzero count */
+        int32_t NonzeroSize() const;
+        /*!
+         * \brief Call func(topic, count) for the topics with nonzero count,
+         *  until it returns false
+         */
+        template <typename Func>
+        void ForEach(Func func) const;
+        /*! \brief Get the memory read first by At, for prefetch */
+        const void* data() const;
+
+        /*! \brief key of the free slots of a sparse row */
+        static const int32_t kEmptyKey = -1;
+    private:
+        static int32_t Hash(int32_t topic);
+
+        Row<int32_t>* row_;
+        std::atomic<int32_t>* counts_;
+        std::atomic<int32_t>* slots_;
+        int32_t mask_;
+    };
+
+    /*!
+     * \brief SummaryRow is a view of the topic counts of all the words: the
+     *  summary row of a multiverso table, plus the deltas of one thread not
+     *  merged into it yet, if any
+     */
+    class SummaryRow
+    {
+    public:
+        SummaryRow();
+        explicit SummaryRow(Row<int64_t>* row);
+        /*! \brief num_topics counts of SharedModel */
+        explicit SummaryRow(const std::atomic<int64_t>* counts);
+        /*! \brief view of row corrected by the num_topics deltas */
+        SummaryRow(const SummaryRow& row, const int64_t* delta);
+        /*! \brief Get the count of topic */
+        int64_t At(int32_t topic) const;
+    private:
+        Row<int64_t>* row_;
+        const std::atomic<int64_t>* counts_;
+        const int64_t* delta_;
+    };
+
     /*! \brief interface for acceess to model */
     class ModelBase
     {
     public:
         virtual ~ModelBase() {}
-        virtual Row<int32_t>& GetWordTopicRow(integer_t word_id) = 0;
-        virtual Row<int64_t>& GetSummaryRow() = 0;
+        virtual WordTopicRow GetWordTopicRow(integer_t word_id) = 0;
+        virtual SummaryRow GetSummaryRow() = 0;
         virtual void AddWordTopicRow(integer_t word_id, integer_t topic_id, 
             int32_t delta) = 0;
         virtual void AddSummaryRow(integer_t topic_id, int64_t delta) = 0;
+        /*!
+         * \brief Send the updates buffered by the model, and by the models
+         *  it wraps, if any
+         */
+        virtual void Flush() {}
     };
 
     /*! \brief model based on local buffer */
@@ -41,8 +114,8 @@ namespace lightlda
         explicit LocalModel(Meta * meta);
         void Init();
 
-        Row<int32_t>& GetWordTopicRow(integer_t word_id) override;
-        Row<int64_t>& GetSummaryRow() override;
+        WordTopicRow GetWordTopicRow(integer_t word_id) override;
+        SummaryRow GetSummaryRow() override;
         void AddWordTopicRow(integer_t word_id, integer_t topic_id, 
             int32_t delta) override;
         void AddSummaryRow(integer_t topic_id, int64_t delta) override;
@@ -65,21 +138,292 @@ namespace lightlda
     class PSModel : public ModelBase
     {
     public:
-        explicit PSModel(Trainer* trainer) : trainer_(trainer) {}
+        /*!
+         * \brief Creates a model of trainer. If alias is not null, changes of
+         *  word counts are recorded in it for alias reuse
+         */
+        PSModel(Trainer* trainer, AliasTable* alias) 
+            : trainer_(trainer), alias_(alias) {}
 
-        Row<int32_t>& GetWordTopicRow(integer_t word_id) override;
-        Row<int64_t>& GetSummaryRow() override;
+        WordTopicRow GetWordTopicRow(integer_t word_id) override;
+        SummaryRow GetSummaryRow() override;
         void AddWordTopicRow(integer_t word_id, integer_t topic_id, 
             int32_t delta) override;
         void AddSummaryRow(integer_t topic_id, int64_t delta) override;
 
     private:
         Trainer* trainer_;
+        AliasTable* alias_;
 
         PSModel(const PSModel&) = delete;
         void operator=(const PSModel&) = delete;
     };
 
+    /*!
+     * \brief model of a single process, in its memory and without parameter
+     *  server, shared by all the trainers, which update it with atomic adds.
+     *  Word-topic rows are laid out as in SliceArena, for all the words: a
+     *  dense row of num_topics counts for a word of high tf, otherwise an
+     *  open addressing table of topics and counts. The topics a sparse row
+     *  lost are removed by Compact before each slice, so that the table has
+     *  room for the topics it may take while the slice is sampled
+     */
+    class SharedModel : public ModelBase
+    {
+    public:
+        /*!
+         * \brief Creates the model of the words of meta. If alias is not
+         *  null, changes of word counts are recorded in it for alias reuse
+         */
+        SharedModel(Meta* meta, AliasTable* alias);
+        /*!
+         * \brief Remove the topics of count 0 from the sparse rows of share
+         *  id of num_threads of the words of slice, each of the num_threads
+         *  threads calls with its id before the rows are read
+         */
+        void Compact(const LocalVocab& local_vocab, int32_t slice, 
+            int32_t id, int32_t num_threads);
+        /*!
+         * \brief Write the model in the files of the parameter server,
+         *  server_0_table_<table>.model, which LocalModel loads
+         */
+        void Dump();
+
+        WordTopicRow GetWordTopicRow(integer_t word_id) override;
+        SummaryRow GetSummaryRow() override;
+        void AddWordTopicRow(integer_t word_id, integer_t topic_id, 
+            int32_t delta) override;
+        void AddSummaryRow(integer_t topic_id, int64_t delta) override;
+
+    private:
+        AliasTable* alias_;
+        /*! \brief offset of the row of each word in memory_, -1 if no row */
+        std::vector<int64_t> offset_;
+        /*! \brief slots of the row of each word, 0 if dense */
+        std::vector<int32_t> slots_;
+        std::unique_ptr<std::atomic<int32_t>[]> memory_;
+        std::unique_ptr<std::atomic<int64_t>[]> summary_;
+
+        SharedModel(const SharedModel&) = delete;
+        void operator=(const SharedModel&) = delete;
+    };
+
+    /*!
+     * \brief model reading the word-topic rows of a slice from a SliceArena.
+     *  Updates of word-topic rows go to the arena, and reach the model it
+     *  wraps by SliceArena::Flush. Summary row is the one of the model
+     */
+    class ArenaModel : public ModelBase
+    {
+    public:
+        ArenaModel(ModelBase* model, SliceArena* arena)
+            : model_(model), arena_(arena) {}
+
+        WordTopicRow GetWordTopicRow(integer_t word_id) override;
+        SummaryRow GetSummaryRow() override;
+        void AddWordTopicRow(integer_t word_id, integer_t topic_id, 
+            int32_t delta) override;
+        void AddSummaryRow(integer_t topic_id, int64_t delta) override;
+
+    private:
+        ModelBase* model_;
+        SliceArena* arena_;
+
+        ArenaModel(const ArenaModel&) = delete;
+        void operator=(const ArenaModel&) = delete;
+    };
+
+    /*!
+     * \brief model summing the updates of one thread by word and topic, and
+     *  by topic, before sending them to the model it wraps. A flush sends the
+     *  net nonzero deltas only, a token leaving a topic and coming back costs
+     *  nothing. Reads of the summary row see the deltas of the thread, reads
+     *  of word-topic rows do not see them until they are flushed. The
+     *  word-topic buffer flushes itself once half full
+     */
+    class DeltaModel : public ModelBase
+    {
+    public:
+        /*!
+         * \brief Creates a buffer of model. If alias is not null, the inverse
+         *  summary of the flushed topics is refreshed in it
+         * \param buffer_words whether to buffer word-topic updates, or only
+         *  summary ones
+         */
+        DeltaModel(ModelBase* model, AliasTable* alias, bool buffer_words);
+        /*! \brief Whether trainers buffer updates with the current Config */
+        static bool Enabled();
+
+        WordTopicRow GetWordTopicRow(integer_t word_id) override;
+        SummaryRow GetSummaryRow() override;
+        void AddWordTopicRow(integer_t word_id, integer_t topic_id, 
+            int32_t delta) override;
+        void AddSummaryRow(integer_t topic_id, int64_t delta) override;
+        void Flush() override;
+        /*! \brief Send the buffered word-topic updates */
+        void FlushWords();
+        /*! \brief Send the buffered summary updates */
+        void FlushSummary();
+
+    private:
+        /*! \brief number of slots of the word-topic buffer */
+        static const int32_t kCapacityBits = 15;
+        static const int32_t kCapacity = 1 << kCapacityBits;
+
+        ModelBase* model_;
+        AliasTable* alias_;
+        bool buffer_words_;
+        /*! 
+         * \brief open addressing table of word << 32 | topic, -1 if free,
+         *  and the delta of each key
+         */
+        std::vector<int64_t> keys_;
+        std::vector<int32_t> deltas_;
+        /*! \brief slots taken, in order */
+        std::vector<int32_t> used_;
+        std::vector<int64_t> summary_delta_;
+        std::vector<int32_t> summary_touched_;
+
+        DeltaModel(const DeltaModel&) = delete;
+        void operator=(const DeltaModel&) = delete;
+    };
+
+    /*!
+     * \brief model giving one thread a private dense copy of the rows of
+     *  the words of highest tf of a slice, which take most of the updates.
+     *  Reads and updates of these rows stay in the copy, which does not see
+     *  the updates of other threads, and the net changes are sent to the
+     *  model it wraps by Flush, once the slice is sampled. Other rows go to
+     *  the wrapped model. Takes 8 * num_words * num_topics bytes
+     */
+    class ReplicaModel : public ModelBase
+    {
+    public:
+        ReplicaModel(ModelBase* model, int32_t num_words);
+        /*!
+         * \brief Copy the rows of the num_words words of highest tf of slice
+         *  from the wrapped model, once the rows are readable
+         */
+        void Load(const LocalVocab& local_vocab, int32_t slice, Meta* meta);
+
+        WordTopicRow GetWordTopicRow(integer_t word_id) override;
+        SummaryRow GetSummaryRow() override;
+        void AddWordTopicRow(integer_t word_id, integer_t topic_id, 
+            int32_t delta) override;
+        void AddSummaryRow(integer_t topic_id, int64_t delta) override;
+        void Flush() override;
+
+    private:
+        /*! \brief Get the index of the copy of word, -1 if not copied */
+        int32_t Find(integer_t word_id) const;
+
+        ModelBase* model_;
+        int32_t num_words_;
+        /*! \brief copied words, and an open addressing table of their index */
+        std::vector<int32_t> words_;
+        std::vector<int32_t> table_;
+        int32_t mask_;
+        /*! \brief dense copy of the rows, and the changes since copied */
+        std::unique_ptr<std::atomic<int32_t>[]> counts_;
+        std::vector<int32_t> delta_;
+
+        ReplicaModel(const ReplicaModel&) = delete;
+        void operator=(const ReplicaModel&) = delete;
+    };
+
+    // -- inline functions definition area --------------------------------- //
+    inline int32_t ReplicaModel::Find(integer_t word_id) const
+    {
+        uint32_t hash = static_cast<uint32_t>(word_id) * 2654435761u;
+        for (int32_t i = hash & mask_; ; i = (i + 1) & mask_)
+        {
+            int32_t index = table_[i];
+            if (index == -1 || words_[index] == word_id) return index;
+        }
+    }
+
+    inline SummaryRow::SummaryRow() 
+        : row_(nullptr), counts_(nullptr), delta_(nullptr) {}
+    inline SummaryRow::SummaryRow(Row<int64_t>* row)
+        : row_(row), counts_(nullptr), delta_(nullptr) {}
+    inline SummaryRow::SummaryRow(const std::atomic<int64_t>* counts)
+        : row_(nullptr), counts_(counts), delta_(nullptr) {}
+    inline SummaryRow::SummaryRow(const SummaryRow& row, 
+        const int64_t* delta)
+        : row_(row.row_), counts_(row.counts_), delta_(delta) {}
+
+    inline int64_t SummaryRow::At(int32_t topic) const
+    {
+        int64_t count = row_ != nullptr ? row_->At(topic) :
+            counts_[topic].load(std::memory_order_relaxed);
+        return delta_ == nullptr ? count : count + delta_[topic];
+    }
+
+    inline WordTopicRow::WordTopicRow()
+        : row_(nullptr), counts_(nullptr), slots_(nullptr), mask_(0) {}
+    inline WordTopicRow::WordTopicRow(Row<int32_t>* row)
+        : row_(row), counts_(nullptr), slots_(nullptr), mask_(0) {}
+    inline WordTopicRow::WordTopicRow(std::atomic<int32_t>* counts)
+        : row_(nullptr), counts_(counts), slots_(nullptr), mask_(0) {}
+    inline WordTopicRow::WordTopicRow(std::atomic<int32_t>* slots, 
+        int32_t mask)
+        : row_(nullptr), counts_(nullptr), slots_(slots), mask_(mask) {}
+
+    inline int32_t WordTopicRow::Hash(int32_t topic)
+    {
+        // Odd multiplier, a permutation of the topics modulo the capacity
+        return static_cast<int32_t>(static_cast<uint32_t>(topic) * 2654435761u);
+    }
+
+    inline int32_t WordTopicRow::At(int32_t topic) const
+    {
+        if (row_ != nullptr) return row_->At(topic);
+        if (slots_ == nullptr) return counts_[topic].load(std::memory_order_relaxed);
+        for (int32_t i = Hash(topic) & mask_; ; i = (i + 1) & mask_)
+        {
+            int32_t key = slots_[2 * i].load(std::memory_order_relaxed);
+            if (key == topic) 
+                return slots_[2 * i + 1].load(std::memory_order_relaxed);
+            if (key == kEmptyKey) return 0;
+        }
+    }
+
+    template <typename Func>
+    inline void WordTopicRow::ForEach(Func func) const
+    {
+        if (row_ != nullptr)
+        {
+            Row<int32_t>::iterator iter = row_->Iterator();
+            for (; iter.HasNext(); iter.Next())
+            {
+                if (iter.Value() != 0 && !func(iter.Key(), iter.Value())) return;
+            }
+            return;
+        }
+        if (slots_ == nullptr)
+        {
+            for (int32_t k = 0; k < Config::num_topics; ++k)
+            {
+                int32_t count = counts_[k].load(std::memory_order_relaxed);
+                if (count != 0 && !func(k, count)) return;
+            }
+            return;
+        }
+        for (int32_t i = 0; i <= mask_; ++i)
+        {
+            int32_t count = slots_[2 * i + 1].load(std::memory_order_relaxed);
+            if (count != 0 && 
+                !func(slots_[2 * i].load(std::memory_order_relaxed), count))
+                return;
+        }
+    }
+
+    inline const void* WordTopicRow::data() const
+    {
+        if (row_ != nullptr) return row_;
+        return slots_ != nullptr ? slots_ : counts_;
+    }
+
 } // namespace lightlda
 } // namespace multiverso
 
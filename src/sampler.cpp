@@ -2,14 +2,52 @@
 
 #include "alias_table.h"
 #include "common.h"
+#include "doc_topic_counter.h"
 #include "document.h"
+#include "meta.h"
+#include "mh_batch.h"
 #include "model.h"
 
+#include <algorithm>
+
 #include <multiverso/log.h>
 #include <multiverso/row.h>
 
 namespace multiverso { namespace lightlda
 {
+    bool LightDocSampler::FindKernel(const std::string& name,
+        SampleKernel& kernel, RunKernel& run_kernel)
+    {
+        // Registry of sampling kernels, new kernel should be added here
+        static const struct 
+        { 
+            const char* name; 
+            SampleKernel kernel; 
+            RunKernel run_kernel; 
+        } 
+        kKernels[] = 
+        {
+            { "exact", &LightDocSampler::Sample, nullptr },
+            { "approx", &LightDocSampler::ApproxSample, nullptr },
+            // warp trains with WarpSampler, which factorizes the acceptance
+            // rate as approx does. Per document sampling under warp, e.g. 
+            // inference, falls back to approx
+            { "warp", &LightDocSampler::ApproxSample, nullptr },
+            { "batch", &LightDocSampler::Sample, 
+                &LightDocSampler::BatchSample },
+        };
+        for (const auto& entry : kKernels)
+        {
+            if (name == entry.name)
+            {
+                kernel = entry.kernel;
+                run_kernel = entry.run_kernel;
+                return true;
+            }
+        }
+        return false;
+    }
+
     LightDocSampler::LightDocSampler()
     {
         alpha_ = Config::alpha;
@@ -23,68 +61,128 @@ namespace multiverso { namespace lightlda
 
         subtractor_ = Config::inference ? 0 : 1;
 
-        doc_topic_counter_.reset(new Row<int32_t>(0, 
-            multiverso::Format::Sparse, kMaxDocLength));
+        if (!FindKernel(Config::sampler, kernel_, run_kernel_))
+        {
+            Log::Fatal("Unknown sampler: %s\n", Config::sampler.c_str());
+        }
+        kernel_name_ = Config::sampler.c_str();
+
+        doc_topic_counter_.reset(new DocTopicCounter(num_topic_));
+        doc_changed_ = false;
+        buffered_summary_ = !Config::inference && DeltaModel::Enabled();
     }
 
+    LightDocSampler::~LightDocSampler() {}
+
     int32_t LightDocSampler::SampleOneDoc(Document* doc, int32_t slice,
         int32_t lastword, ModelBase* model, AliasTable* alias)
     {
-        DocInit(doc);
         int32_t num_tokens = 0;
         int32_t& cursor = doc->Cursor();
         if (slice == 0) cursor = 0;
-        for (; cursor != doc->Size(); ++cursor)
+        // Nothing of the document in this slice
+        if (cursor == doc->Size() || doc->Word(cursor) > lastword)
+            return num_tokens;
+        DocInit(doc);
+        summary_row_ = model->GetSummaryRow();
+        alias_ = alias;
+        // Word-topic row and alias entry are resolved once for a whole run,
+        // one run ahead, so that their cache misses overlap with sampling
+        // the current run
+        int32_t word = doc->Word(cursor);
+        if (Config::lazy_alias) alias->EnsureBuilt(word, model);
+        WordTopicRow next_row = model->GetWordTopicRow(word);
+        WordEntry* next_entry = &alias->word_entry(word);
+        while (true)
         {
-            int32_t word = doc->Word(cursor);
-            if (word > lastword) break;
-            int32_t old_topic = doc->Topic(cursor);
-            int32_t new_topic = Sample(doc, word, old_topic, old_topic,
-                model, alias);
-            if (old_topic != new_topic)
+            word_topic_row_ = next_row;
+            word_entry_ = next_entry;
+            int32_t run_end = doc->RunEnd(cursor);
+            bool has_next = run_end != doc->Size() && 
+                doc->Word(run_end) <= lastword;
+            int32_t next_word = has_next ? doc->Word(run_end) : -1;
+            if (has_next)
+            {
+                if (Config::lazy_alias) alias->EnsureBuilt(next_word, model);
+                next_row = model->GetWordTopicRow(next_word);
+                next_entry = &alias->word_entry(next_word);
+                _PREFETCH(next_row.data());
+                alias->Prefetch(next_word, *next_entry);
+            }
+            if (run_kernel_ != nullptr)
             {
-                doc->SetTopic(cursor, new_topic);
-                doc_topic_counter_->Add(old_topic, -1);
-                doc_topic_counter_->Add(new_topic, 1);
-                if(!Config::inference)
+                (this->*run_kernel_)(doc, word, cursor, run_end, model, alias);
+                num_tokens += run_end - cursor;
+                cursor = run_end;
+            }
+            for (; cursor != run_end; ++cursor)
+            {
+                int32_t old_topic = doc->Topic(cursor);
+                int32_t new_topic = (this->*kernel_)(doc, word, old_topic, 
+                    old_topic, alias);
+                if (old_topic != new_topic)
                 {
-                    model->AddWordTopicRow(word, old_topic, -1);
-                    model->AddSummaryRow(old_topic, -1);
-                    model->AddWordTopicRow(word, new_topic, 1);
-                    model->AddSummaryRow(new_topic, 1);
+                    UpdateToken(doc, cursor, word, old_topic, new_topic, 
+                        model);
                 }
+                ++num_tokens;
             }
-            ++num_tokens;
+            if (!has_next) break;
+            word = next_word;
         }
+        if (doc_changed_) doc->SaveDocTopicVector(*doc_topic_counter_);
         return num_tokens;
     }
 
+    void LightDocSampler::UpdateToken(Document* doc, int32_t index,
+        int32_t word, int32_t old_topic, int32_t new_topic, ModelBase* model)
+    {
+        doc->SetTopic(index, new_topic);
+        doc_topic_counter_->Add(old_topic, -1);
+        doc_topic_counter_->Add(new_topic, 1);
+        doc_changed_ = true;
+        if(!Config::inference)
+        {
+            model->AddWordTopicRow(word, old_topic, -1);
+            model->AddSummaryRow(old_topic, -1);
+            model->AddWordTopicRow(word, new_topic, 1);
+            model->AddSummaryRow(new_topic, 1);
+            // Buffered summary updates refresh the shared reciprocals once
+            // they are merged
+            if (!buffered_summary_)
+            {
+                alias_->UpdateInvSummary(old_topic, summary_row_.At(old_topic));
+                alias_->UpdateInvSummary(new_topic, summary_row_.At(new_topic));
+            }
+        }
+    }
+
     void LightDocSampler::DocInit(Document* doc)
     {
-        doc_topic_counter_->Clear();
         doc->GetDocTopicVector(*doc_topic_counter_);
+        doc_changed_ = false;
     }
 
     int32_t LightDocSampler::Sample(Document* doc,
-        int32_t word, int32_t old_topic, int32_t s,
-        ModelBase* model, AliasTable* alias)
+        int32_t word, int32_t old_topic, int32_t s, AliasTable* alias)
     {
         int32_t t, w_t_cnt, w_s_cnt;
         int64_t n_t, n_s;
         float n_td_alpha, n_sd_alpha;
         float n_tw_beta, n_sw_beta, n_t_beta_sum, n_s_beta_sum;
         float proposal_t, proposal_s;
+        float inv_t, inv_s;
         float nominator, denominator;
-        double rejection, pi;
+        double rejection;
         int32_t m;
 
-        Row<int32_t>& word_topic_row = model->GetWordTopicRow(word);
-        Row<int64_t>& summary_row = model->GetSummaryRow();
+        const WordTopicRow& word_topic_row = word_topic_row_;
+        const SummaryRow& summary_row = summary_row_;
 
         for (int32_t i = 0; i < mh_steps_; ++i)
         {
             // Word proposal
-            t = alias->Propose(word, rng_);
+            t = alias->Propose(word, *word_entry_, rng_);
             if (t < 0 || t >= num_topic_)
             {
                 Log::Fatal("Invalid topic assignment %d from word proposal\n", t);
@@ -95,37 +193,36 @@ namespace multiverso { namespace lightlda
 
                 w_t_cnt = word_topic_row.At(t);
                 w_s_cnt = word_topic_row.At(s);
-                n_t = summary_row.At(t);
-                n_s = summary_row.At(s);
+                inv_t = alias->InvSummary(t);
+                inv_s = alias->InvSummary(s);
 
                 n_td_alpha = doc_topic_counter_->At(t) + alpha_;
                 n_sd_alpha = doc_topic_counter_->At(s) + alpha_;
                 n_tw_beta = w_t_cnt + beta_;
-                n_t_beta_sum = n_t + beta_sum_;
                 n_sw_beta = w_s_cnt + beta_;
-                n_s_beta_sum = n_s + beta_sum_;
+                // (n_k + beta_sum - subtractor) * proposal_k, with proposal
+                // (n_kw + beta) / (n_k + beta_sum), leaves (n_kw + beta) and
+                // a correction factor from the reciprocal summary table
+                proposal_s = (w_s_cnt + beta_);
+                proposal_t = (w_t_cnt + beta_);
                 if (s == old_topic)
                 {
                     --n_sd_alpha;
                     n_sw_beta -= subtractor_;
-                    n_s_beta_sum -= subtractor_;
+                    proposal_s *= 1.0f - subtractor_ * inv_s;
                 }
                 if (t == old_topic)
                 {
                     --n_td_alpha;
                     n_tw_beta -= subtractor_;
-                    n_t_beta_sum -= subtractor_;
+                    proposal_t *= 1.0f - subtractor_ * inv_t;
                 }
 
-                proposal_s = (w_s_cnt + beta_) / (n_s + beta_sum_);
-                proposal_t = (w_t_cnt + beta_) / (n_t + beta_sum_);
-
-                nominator = n_td_alpha * n_tw_beta * n_s_beta_sum * proposal_s;
-                denominator = n_sd_alpha * n_sw_beta * n_t_beta_sum * proposal_t;
-
-                pi = nominator / denominator;
+                nominator = n_td_alpha * n_tw_beta * proposal_s;
+                denominator = n_sd_alpha * n_sw_beta * proposal_t;
 
-                m = -(rejection < pi);
+                // rejection < nominator / denominator, denominator > 0
+                m = -(rejection * denominator < nominator);
                 s = (t & m) | (s & ~m);
             }
             // Doc proposal
@@ -175,9 +272,7 @@ namespace multiverso { namespace lightlda
                 nominator = n_td_alpha * n_tw_beta * n_s_beta_sum * proposal_s;
                 denominator = n_sd_alpha * n_sw_beta * n_t_beta_sum * proposal_t;
 
-                pi = nominator / denominator;
-
-                m = -(rejection < pi);
+                m = -(rejection * denominator < nominator);
                 s = (t & m) | (s & ~m);
             }
         }
@@ -185,21 +280,20 @@ namespace multiverso { namespace lightlda
     }
 
     int32_t LightDocSampler::ApproxSample(Document* doc,
-        int32_t word, int32_t old_topic, int32_t s,
-        ModelBase* model, AliasTable* alias)
+        int32_t word, int32_t old_topic, int32_t s, AliasTable* alias)
     {
         float n_tw_beta, n_sw_beta, n_t_beta_sum, n_s_beta_sum;
         float nominator, denominator;
-        double rejection, pi;
+        double rejection;
         int32_t m, t;
         
-        Row<int32_t>& word_topic_row = model->GetWordTopicRow(word);
-        Row<int64_t>& summary_row = model->GetSummaryRow();
+        const WordTopicRow& word_topic_row = word_topic_row_;
+        const SummaryRow& summary_row = summary_row_;
 
         for (int32_t i = 0; i < mh_steps_; ++i)
         {
             // word proposal
-            t = alias->Propose(word, rng_);
+            t = alias->Propose(word, *word_entry_, rng_);
             if (t != s)
             {
                 nominator = doc_topic_counter_->At(t) + alpha_;
@@ -212,9 +306,8 @@ namespace multiverso { namespace lightlda
                 {
                     denominator -= 1;
                 }
-                pi = nominator / denominator;
                 rejection = rng_.rand_double();
-                m = -(rejection < pi);
+                m = -(rejection * denominator < nominator);
                 s = (t & m) | (s & ~m);
             }
             // doc proposal
@@ -249,13 +342,129 @@ namespace multiverso { namespace lightlda
                 
                 nominator = n_tw_beta * n_s_beta_sum;
                 denominator = n_sw_beta * n_t_beta_sum;
-                pi = nominator / denominator;
                 rejection = rng_.rand_double();
-                m = -(rejection < pi);
+                m = -(rejection * denominator < nominator);
                 s = (t & m) | (s & ~m);
             }
         }
         return s;
     }
+
+    void LightDocSampler::BatchSample(Document* doc, int32_t word,
+        int32_t begin, int32_t end, ModelBase* model, AliasTable* alias)
+    {
+        MHBatch batch;
+        int32_t old_topic[MHBatch::kSize];
+        const WordTopicRow& word_topic_row = word_topic_row_;
+        const SummaryRow& summary_row = summary_row_;
+
+        // Gather the counts of token j of the batch, as Sample does
+        auto gather = [&](int32_t j, bool word_proposal)
+        {
+            int32_t t = batch.t[j];
+            int32_t s = batch.s[j];
+            if (t == s)
+            {
+                // nothing to evaluate, make sure the lane keeps s. The 
+                // lane is still computed by the SIMD kernels, so it holds
+                // neutral values rather than those of an earlier step
+                batch.n_td_alpha[j] = batch.n_sd_alpha[j] = 1.0f;
+                batch.n_tw_beta[j] = batch.n_sw_beta[j] = 1.0f;
+                batch.n_t_beta_sum[j] = batch.n_s_beta_sum[j] = 1.0f;
+                batch.proposal_t[j] = batch.proposal_s[j] = 1.0f;
+                batch.rejection[j] = 2.0f;
+                return;
+            }
+            batch.rejection[j] = static_cast<float>(rng_.rand_double());
+            int32_t w_t_cnt = word_topic_row.At(t);
+            int32_t w_s_cnt = word_topic_row.At(s);
+            int32_t n_td = doc_topic_counter_->At(t);
+            int32_t n_sd = doc_topic_counter_->At(s);
+            batch.n_td_alpha[j] = n_td + alpha_;
+            batch.n_sd_alpha[j] = n_sd + alpha_;
+            batch.n_tw_beta[j] = w_t_cnt + beta_;
+            batch.n_sw_beta[j] = w_s_cnt + beta_;
+            if (word_proposal)
+            {
+                // As in Sample, the summary cancels against the proposal
+                // up to a correction from the reciprocal summary table
+                batch.n_t_beta_sum[j] = 1.0f;
+                batch.n_s_beta_sum[j] = 1.0f;
+                batch.proposal_s[j] = w_s_cnt + beta_;
+                batch.proposal_t[j] = w_t_cnt + beta_;
+            }
+            else
+            {
+                batch.n_t_beta_sum[j] = summary_row.At(t) + beta_sum_;
+                batch.n_s_beta_sum[j] = summary_row.At(s) + beta_sum_;
+                batch.proposal_s[j] = n_sd + alpha_;
+                batch.proposal_t[j] = n_td + alpha_;
+            }
+            if (s == old_topic[j])
+            {
+                --batch.n_sd_alpha[j];
+                batch.n_sw_beta[j] -= subtractor_;
+                batch.n_s_beta_sum[j] -= word_proposal ? 
+                    subtractor_ * alias->InvSummary(s) : subtractor_;
+            }
+            if (t == old_topic[j])
+            {
+                --batch.n_td_alpha[j];
+                batch.n_tw_beta[j] -= subtractor_;
+                batch.n_t_beta_sum[j] -= word_proposal ? 
+                    subtractor_ * alias->InvSummary(t) : subtractor_;
+            }
+        };
+
+        for (int32_t first = begin; first < end; first += MHBatch::kSize)
+        {
+            int32_t size = std::min(MHBatch::kSize, end - first);
+            for (int32_t j = 0; j < size; ++j)
+            {
+                old_topic[j] = doc->Topic(first + j);
+                batch.s[j] = old_topic[j];
+            }
+            for (int32_t i = 0; i < mh_steps_; ++i)
+            {
+                // Word proposal
+                for (int32_t j = 0; j < size; ++j)
+                {
+                    batch.t[j] = alias->Propose(word, *word_entry_, rng_);
+                    if (batch.t[j] < 0 || batch.t[j] >= num_topic_)
+                    {
+                        Log::Fatal("Invalid topic assignment %d from word "
+                            "proposal\n", batch.t[j]);
+                    }
+                    gather(j, true);
+                }
+                batch.Accept(size);
+                // Doc proposal
+                for (int32_t j = 0; j < size; ++j)
+                {
+                    double n_td_or_alpha = rng_.rand_double() *
+                        (doc->Size() + alpha_sum_);
+                    if (n_td_or_alpha < doc->Size())
+                    {
+                        int32_t t_idx = static_cast<int32_t>(n_td_or_alpha);
+                        batch.t[j] = doc->Topic(t_idx);
+                    }
+                    else
+                    {
+                        batch.t[j] = rng_.rand_k(num_topic_);
+                    }
+                    gather(j, false);
+                }
+                batch.Accept(size);
+            }
+            for (int32_t j = 0; j < size; ++j)
+            {
+                if (batch.s[j] != old_topic[j])
+                {
+                    UpdateToken(doc, first + j, word, old_topic[j], 
+                        batch.s[j], model);
+                }
+            }
+        }
+    }
 } // namespace lightlda
 } // namespace multiverso
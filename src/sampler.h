@@ -7,6 +7,8 @@
 #define LIGHTLDA_SAMPLER_H_
 
 #include <memory>
+#include <string>
+#include "model.h"
 #include "util.h"
 
 namespace multiverso
@@ -18,14 +20,16 @@ namespace multiverso
 namespace multiverso { namespace lightlda
 {
     class AliasTable;
+    class DocTopicCounter;
     class Document;
-    class ModelBase;
+    struct WordEntry;
     
     /*! \brief lightlda sampler */
     class LightDocSampler
     {
     public:
         LightDocSampler();
+        ~LightDocSampler();
         /*! 
          * \brief Sample one document, update latent topic assignment 
          *  and statistics
@@ -42,24 +46,52 @@ namespace multiverso { namespace lightlda
          * \brief Get doc-topic-counter, for reusing this container
          * \return reference to light hash map
          */
-        Row<int32_t>& doc_topic_counter() { return *doc_topic_counter_; }
+        DocTopicCounter& doc_topic_counter() { return *doc_topic_counter_; }
+        /*! \brief Restart random number generator at a stream */
+        void Seed(uint64_t key, uint64_t stream) { rng_.Seed(key, stream); }
+        /*! \brief Get the name of the sampling kernel in use */
+        const char* kernel_name() const { return kernel_name_; }
     private:
+        /*! \brief signature shared by all the sampling kernels */
+        typedef int32_t (LightDocSampler::*SampleKernel)(Document* doc, 
+            int32_t word, int32_t state, int32_t old_topic, 
+            AliasTable* alias);
+        /*! \brief signature of the kernels sampling a whole word run */
+        typedef void (LightDocSampler::*RunKernel)(Document* doc,
+            int32_t word, int32_t begin, int32_t end, 
+            ModelBase* model, AliasTable* alias);
+        /*!
+         * \brief Look up a sampling kernel by name
+         * \param name kernel name, as given by -sampler
+         * \param kernel output, the per token kernel with this name
+         * \param run_kernel output, the per run kernel with this name, 
+         *  nullptr if the kernel samples token by token
+         * \return true if the kernel exists
+         */
+        static bool FindKernel(const std::string& name, SampleKernel& kernel,
+            RunKernel& run_kernel);
+
         /*!
          * \brief Init document before sampling
          * \param doc pointer to document
          */
         void DocInit(Document* doc);
+        /*!
+         * \brief Update document and model after a token changes topic
+         */
+        void UpdateToken(Document* doc, int32_t index, int32_t word,
+            int32_t old_topic, int32_t new_topic, ModelBase* model);
         /*!
          * \brief Sample the latent topic assignment for a token 
          * \param doc current document
          * \param word current token
          * \param state state of the word
          * \param old_topic old topic assignment of this token
-         * \param model access
          * \param alias for alias table access
+         *  Rows of the word are taken from the current word run
          */
         int32_t Sample(Document* doc, int32_t word, int32_t state, 
-            int32_t old_topic, ModelBase* model, AliasTable* alias);
+            int32_t old_topic, AliasTable* alias);
 
         /*! 
          * \brief Sample the latent topic assignment for a token. This function
@@ -69,7 +101,22 @@ namespace multiverso { namespace lightlda
          * \param same with Sample
          */
         int32_t ApproxSample(Document* doc, int32_t word, int32_t state, 
-            int32_t old_topic, ModelBase* model, AliasTable* alias);
+            int32_t old_topic, AliasTable* alias);
+
+        /*!
+         * \brief Sample the tokens [begin, end) of a word run in batches, 
+         *  evaluating the acceptance rates of a batch with MHBatch. Same 
+         *  acceptance rate as Sample, but tokens of a batch only see the
+         *  updates of previous batches
+         * \param doc current document
+         * \param word word of the run
+         * \param begin first token of the run
+         * \param end last token + 1 of the run
+         * \param model access
+         * \param alias for alias table access
+         */
+        void BatchSample(Document* doc, int32_t word, int32_t begin,
+            int32_t end, ModelBase* model, AliasTable* alias);
     private:
         // lda hyper-parameter
         float alpha_;
@@ -83,8 +130,22 @@ namespace multiverso { namespace lightlda
         int32_t num_topic_;
         int32_t mh_steps_;
 
-        xorshift_rng rng_;
-        std::unique_ptr<Row<int32_t>> doc_topic_counter_;
+        SampleKernel kernel_;
+        RunKernel run_kernel_;
+        const char* kernel_name_;
+
+        philox_rng rng_;
+        std::unique_ptr<DocTopicCounter> doc_topic_counter_;
+        /*! \brief whether a topic of current document has changed */
+        bool doc_changed_;
+        /*! \brief whether the model buffers summary updates, see DeltaModel */
+        bool buffered_summary_;
+
+        // current word run, resolved once for all tokens of the run
+        WordTopicRow word_topic_row_;
+        SummaryRow summary_row_;
+        WordEntry* word_entry_;
+        AliasTable* alias_;
     };
 } // namespace lightlda
 } // namespace multiverso
@@ -0,0 +1,111 @@
+#include "slice_arena.h"
+
+#include "common.h"
+
+#include <algorithm>
+
+#include <multiverso/log.h>
+
+namespace multiverso { namespace lightlda
+{
+    SliceArena::SliceArena()
+        : words_(nullptr), num_words_(0), memory_size_(0)
+    {}
+
+    int32_t SliceArena::Slots(int32_t tf, int32_t local_tf)
+    {
+        // At least twice the topics the row may take, as a power of 2
+        int64_t topics = std::min<int64_t>(
+            static_cast<int64_t>(tf) + local_tf, Config::num_topics);
+        int64_t slots = 1;
+        while (slots < 2 * topics) slots <<= 1;
+        // A slot takes 2 ints, topic and count
+        return 2 * slots < Config::num_topics ? static_cast<int32_t>(slots) : 0;
+    }
+
+    void SliceArena::Layout(const LocalVocab& local_vocab, int32_t slice,
+        Meta* meta)
+    {
+        words_ = local_vocab.begin(slice);
+        num_words_ = static_cast<int32_t>(local_vocab.end(slice) - words_);
+        rank_.Clear();
+        offset_.resize(num_words_);
+        slots_.resize(num_words_);
+        int64_t size = 0;
+        for (int32_t i = 0; i < num_words_; ++i)
+        {
+            int32_t word = words_[i];
+            rank_.Push(word);
+            offset_[i] = size;
+            slots_[i] = Slots(meta->tf(word), meta->local_tf(word));
+            size += slots_[i] == 0 ? Config::num_topics : 2 * slots_[i];
+        }
+        // The memory is kept for the next slices, grown if needed
+        if (size > memory_size_)
+        {
+            memory_.reset(new std::atomic<int32_t>[size]);
+            memory_size_ = size;
+            Log::Info("Slice arena capacity: %lld MB\n",
+                static_cast<long long>(size * sizeof(int32_t) / 1024 / 1024));
+        }
+    }
+
+    void SliceArena::Load(ModelBase* model, int32_t id, int32_t num_threads)
+    {
+        for (int32_t i = id; i < num_words_; i += num_threads)
+        {
+            // Dense counts, or slots of a topic and its count
+            std::atomic<int32_t>* memory = memory_.get() + offset_[i];
+            int32_t slots = slots_[i];
+            if (slots == 0)
+            {
+                for (int32_t k = 0; k < Config::num_topics; ++k)
+                    memory[k].store(0, std::memory_order_relaxed);
+            }
+            for (int32_t k = 0; k < slots; ++k)
+            {
+                memory[2 * k].store(WordTopicRow::kEmptyKey,
+                    std::memory_order_relaxed);
+                memory[2 * k + 1].store(0, std::memory_order_relaxed);
+            }
+            WordTopicRow arena_row = row(words_[i]);
+            model->GetWordTopicRow(words_[i]).ForEach(
+                [&arena_row](int32_t topic, int32_t count)
+            {
+                arena_row.Add(topic, count);
+                return true;
+            });
+        }
+    }
+
+    void SliceArena::Flush(ModelBase* model, int32_t id, int32_t num_threads)
+    {
+        for (int32_t i = id; i < num_words_; i += num_threads)
+        {
+            int32_t word = words_[i];
+            std::atomic<int32_t>* memory = memory_.get() + offset_[i];
+            int32_t slots = slots_[i];
+            WordTopicRow model_row = model->GetWordTopicRow(word);
+            // Every topic of the model row got a slot on load, the slots of
+            // the row cover all the changed counts
+            int32_t size = slots == 0 ? Config::num_topics : slots;
+            for (int32_t k = 0; k < size; ++k)
+            {
+                int32_t topic = k, count;
+                if (slots == 0)
+                {
+                    count = memory[k].load(std::memory_order_relaxed);
+                }
+                else
+                {
+                    topic = memory[2 * k].load(std::memory_order_relaxed);
+                    if (topic == WordTopicRow::kEmptyKey) continue;
+                    count = memory[2 * k + 1].load(std::memory_order_relaxed);
+                }
+                int32_t delta = count - model_row.At(topic);
+                if (delta != 0) model->AddWordTopicRow(word, topic, delta);
+            }
+        }
+    }
+} // namespace lightlda
+} // namespace multiverso
@@ -0,0 +1,84 @@
+/*!
+ * \file slice_arena.h
+ * \brief Defines the arena of the word-topic rows of a slice
+ */
+
+#ifndef LIGHTLDA_SLICE_ARENA_H_
+#define LIGHTLDA_SLICE_ARENA_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "meta.h"
+#include "model.h"
+
+namespace multiverso { namespace lightlda
+{
+    /*!
+     * \brief SliceArena holds a copy of the word-topic rows of the words of
+     *  a slice, in one contiguous block of memory. A word with a high tf has
+     *  num_topics dense counts, others an open addressing table of topics and
+     *  counts. The table has room for all the topics a word may take while
+     *  the slice is sampled: the topics it has, at most tf, and one new topic
+     *  per token of the block, so slots are never removed or moved. The rows
+     *  are laid out by one thread, then copied by all the trainers. Updates
+     *  while sampling go to the arena only, and are added to the model, one
+     *  per changed count, once the slice is sampled.
+     */
+    class SliceArena
+    {
+    public:
+        SliceArena();
+        /*! \brief Lay out the rows of the words of slice of a block */
+        void Layout(const LocalVocab& local_vocab, int32_t slice, Meta* meta);
+        /*!
+         * \brief Copy the rows of share id of num_threads from model, each
+         *  of the num_threads threads calls with its id after Layout
+         */
+        void Load(ModelBase* model, int32_t id, int32_t num_threads);
+        /*!
+         * \brief Add the changes of the rows of share id of num_threads to
+         *  model, where they were loaded from and are unchanged since
+         */
+        void Flush(ModelBase* model, int32_t id, int32_t num_threads);
+        /*! \brief Get the row of a word of the slice */
+        WordTopicRow row(int32_t word);
+        /*!
+         * \brief Get the number of slots of the sparse row of a word, with
+         *  room for the topics it may take while a slice is sampled, 0 if
+         *  the row is dense
+         */
+        static int32_t Slots(int32_t tf, int32_t local_tf);
+    private:
+
+        /*! \brief words of the slice */
+        const int32_t* words_;
+        int32_t num_words_;
+        VocabRank rank_;
+        /*! \brief offset of the row of each word in memory_ */
+        std::vector<int64_t> offset_;
+        /*! \brief slots of the row of each word, 0 if dense */
+        std::vector<int32_t> slots_;
+        std::unique_ptr<std::atomic<int32_t>[]> memory_;
+        int64_t memory_size_;
+
+        // No copying allowed
+        SliceArena(const SliceArena&);
+        void operator=(const SliceArena&);
+    };
+
+    // -- inline functions definition area --------------------------------- //
+    inline WordTopicRow SliceArena::row(int32_t word)
+    {
+        int32_t position = rank_.Position(word);
+        std::atomic<int32_t>* row = memory_.get() + offset_[position];
+        int32_t slots = slots_[position];
+        if (slots == 0) return WordTopicRow(row);
+        return WordTopicRow(row, slots - 1);
+    }
+} // namespace lightlda
+} // namespace multiverso
+
+#endif // LIGHTLDA_SLICE_ARENA_H_
@@ -3,10 +3,14 @@
 #include "alias_table.h"
 #include "common.h"
 #include "data_block.h"
+#include "document.h"
 #include "eval.h"
 #include "meta.h"
+#include "mh_batch.h"
 #include "sampler.h"
 #include "model.h"
+#include "slice_arena.h"
+#include "warp_sampler.h"
 
 #include <multiverso/barrier.h>
 #include <multiverso/stop_watch.h>
@@ -17,20 +21,53 @@ namespace multiverso { namespace lightlda
     std::mutex Trainer::mutex_;
     double Trainer::doc_llh_ = 0.0;
     double Trainer::word_llh_ = 0.0;
+    int64_t Trainer::perf_tokens_ = 0;
+    double Trainer::perf_seconds_ = 0.0;
+    double Trainer::perf_doc_llh_ = 0.0;
+    double Trainer::perf_word_llh_ = 0.0;
+    double Trainer::perf_normalized_llh_ = 0.0;
 
     Trainer::Trainer(AliasTable* alias_table, 
-		Barrier* barrier, Meta* meta) : 
-        alias_(alias_table), barrier_(barrier), meta_(meta),
-        model_(nullptr)
+		Barrier* barrier, Meta* meta, SliceArena* arena, 
+        SharedModel* shared_model) : 
+        alias_(alias_table), warp_sampler_(nullptr), seeded_(false),
+        barrier_(barrier), meta_(meta), model_(nullptr),
+        base_model_(shared_model), ps_model_(nullptr),
+        shared_model_(shared_model), arena_model_(nullptr),
+        replica_model_(nullptr), delta_model_(nullptr), arena_(arena)
     {
         sampler_ = new LightDocSampler();
-        model_ = new PSModel(this);
+        // Only alias reuse needs to know the drift of word counts
+        if (shared_model_ == nullptr)
+        {
+            base_model_ = ps_model_ = new PSModel(this,
+                Config::alias_staleness > 0 ? alias_table : nullptr);
+        }
+        model_ = base_model_;
+        if (arena_ != nullptr)
+            model_ = arena_model_ = new ArenaModel(model_, arena_);
+        if (Config::hot_words > 0)
+        {
+            model_ = replica_model_ = new ReplicaModel(model_, 
+                Config::hot_words);
+        }
+        if (DeltaModel::Enabled())
+        {
+            model_ = delta_model_ = new DeltaModel(model_, alias_table,
+                Config::coalesce_docs > 0);
+        }
+        if (Config::sampler == "warp") warp_sampler_ = new WarpSampler();
     }
 
     Trainer::~Trainer()
     {
+        if (builder_.joinable()) builder_.join();
         delete sampler_;
-        delete model_;
+        delete warp_sampler_;
+        delete delta_model_;
+        delete replica_model_;
+        delete arena_model_;
+        delete ps_model_;
     }
 
     void Trainer::TrainIteration(DataBlockBase* data_block)
@@ -48,23 +85,78 @@ namespace multiverso { namespace lightlda
         int32_t id = TrainerId();
         int32_t trainer_num = TrainerCount();
         int32_t lastword = local_vocab.LastWord(slice);
+        // Only the shared model holds the rows of the next slice while
+        // this one is sampled
+        bool pipelined = Config::pipeline_alias && shared_model_ != nullptr;
+        if (!seeded_)
+        {
+            // Trainer id is only known once training starts. Each thread
+            // draws from its own stream, independent of all the others
+            uint64_t stream = philox_rng::StreamId(
+                Multiverso::ProcessRank(), id);
+            sampler_->Seed(Config::seed, stream);
+            if (warp_sampler_ != nullptr)
+                warp_sampler_->Seed(Config::seed, stream);
+            seeded_ = true;
+        }
         if (id == 0)
         {
             Log::Info("Rank = %d, Iter = %d, Block = %d, Slice = %d\n",
                 Multiverso::ProcessRank(), lda_data_block->iteration(),
                 lda_data_block->block(), lda_data_block->slice());
         }
-        // Build Alias table
-        if (id == 0) alias_->Init(meta_->alias_index(block, slice));
-        barrier_->Wait();
-        for (const int32_t* pword = local_vocab.begin(slice) + id;
-            pword < local_vocab.end(slice);
-            pword += trainer_num)
+        // Build Alias table, beta row first, word rows depend on it. A 
+        // very long beta row is split over all the trainers
+        if (id == 0)
         {
-            alias_->Build(*pword, model_);
+            alias_->Init(meta_->alias_index(block, slice),
+                lda_data_block->iteration());
+            if (arena_ != nullptr) arena_->Layout(local_vocab, slice, meta_);
         }
-        if (id == 0) alias_->Build(-1, model_);
+        // Rows of the slice are only read once the trainers are past the
+        // barrier below
+        if (shared_model_ != nullptr)
+            shared_model_->Compact(local_vocab, slice, id, trainer_num);
+        if (AliasTable::ParallelBeta(trainer_num))
+            alias_->BuildBeta(model_, id, trainer_num, barrier_);
+        else if (id == 0)
+            alias_->Build(-1, model_);
+        if (id == 0 && warp_sampler_ != nullptr && !data.HasWordIndex())
+            data.BuildWordIndex();
+        if (id == 0 && local_vocab.num_slice() > 1 && !data.HasSliceIndex())
+            data.BuildSliceIndex();
+        // The word-major pass of warp changes topics without the counts
+        if (id == 0 && Config::keep_doc_topic && warp_sampler_ == nullptr &&
+            !data.HasDocTopicCounts())
+            data.BuildDocTopicCounts();
         barrier_->Wait();
+        // Rows of the slice are in the parameter cache once the slice starts
+        if (arena_ != nullptr)
+        {
+            arena_->Load(base_model_, id, trainer_num);
+            barrier_->Wait();
+        }
+        if (replica_model_ != nullptr)
+            replica_model_->Load(local_vocab, slice, meta_);
+        // With lazy alias, samplers build word rows on first use
+        if (!Config::lazy_alias)
+        {
+            for (const int32_t* pword = local_vocab.begin(slice) + id;
+                pword < local_vocab.end(slice);
+                pword += trainer_num)
+            {
+                alias_->Refresh(*pword, model_);
+            }
+            barrier_->Wait();
+        }
+        // Rows of the next slice go to the other half of the pool, and
+        // are of words nobody samples until then
+        if (id == 0 && pipelined && slice + 1 < local_vocab.num_slice())
+        {
+            builder_ = std::thread(&Trainer::PrebuildAlias, alias_,
+                meta_->alias_index(block, slice + 1), &local_vocab, 
+                slice + 1, base_model_);
+        }
 
         if (TrainerId() == 0)
         {
@@ -72,37 +164,160 @@ namespace multiverso { namespace lightlda
                 Multiverso::ProcessRank(), watch.ElapsedSeconds());
         }
         int32_t num_token = 0;
+        int32_t num_docs = 0;
         watch.Restart();
-        // Train with lightlda sampler
-        for (int32_t doc_id = id; doc_id < data.Size(); doc_id += trainer_num)
+        if (warp_sampler_ != nullptr)
+        {
+            num_token = WarpIteration(lda_data_block);
+        }
+        else
+        {
+            // Train with lightlda sampler
+            if (data.HasSliceIndex())
+            {
+                // Only visit the documents having tokens in this slice
+                const int32_t* docs = data.SliceDocs(slice);
+                const int32_t* cursors = data.SliceCursors(slice);
+                for (int32_t i = id; i < data.SliceSize(slice); i += trainer_num)
+                {
+                    Document* doc = data.GetOneDoc(docs[i]);
+                    doc->Cursor() = cursors[i];
+                    num_token += sampler_->SampleOneDoc(doc, slice, lastword, model_, alias_);
+                    FlushDue(++num_docs);
+                }
+            }
+            else
+            {
+                for (int32_t doc_id = id; doc_id < data.Size(); doc_id += trainer_num)
+                {
+                    Document* doc = data.GetOneDoc(doc_id);
+                    num_token += sampler_->SampleOneDoc(doc, slice, lastword, model_, alias_);
+                    FlushDue(++num_docs);
+                }
+            }
+        }
+        // The next slice starts once its rows are built
+        if (builder_.joinable()) builder_.join();
+        // Evaluation reads the rows of the base model, so the updates 
+        // buffered by every trainer must have reached it
+        model_->Flush();
+        if (arena_ != nullptr || replica_model_ != nullptr || 
+            delta_model_ != nullptr || pipelined)
         {
-            Document* doc = data.GetOneDoc(doc_id);
-            num_token += sampler_->SampleOneDoc(doc, slice, lastword, model_, alias_);
+            barrier_->Wait();
+        }
+        if (arena_ != nullptr)
+        {
+            arena_->Flush(base_model_, id, trainer_num);
+            barrier_->Wait();
+        }
+        bool perf = !Config::perf_log.empty();
+        if (perf)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            perf_tokens_ += num_token;
+            if (id == 0) perf_seconds_ += watch.ElapsedSeconds();
         }
         if (TrainerId() == 0)
         {
             Log::Info("Rank = %d, Training Time used: %.2f s \n", 
                 Multiverso::ProcessRank(), watch.ElapsedSeconds());
-            Log::Info("Rank = %d, sampling throughput: %.6f (tokens/thread/sec) \n", 
-                Multiverso::ProcessRank(), double(num_token) / watch.ElapsedSeconds());
+            // Only the batch kernel dispatches to an instruction set
+            const char* isa = Config::sampler == "batch" ? 
+                MHBatch::IsaName() : "scalar";
+            Log::Info("Rank = %d, sampling throughput: %.6f (tokens/thread/sec), sampler = %s, isa = %s \n", 
+                Multiverso::ProcessRank(), double(num_token) / watch.ElapsedSeconds(),
+                sampler_->kernel_name(), isa);
         }
         watch.Restart();
         // Evaluate loss function
         // Evaluate(lda_data_block);
         
-        if (iter % 5 == 0)
+        if (iter % 5 == 0 || perf)
         {
             Evaluate(lda_data_block);
             if (TrainerId() == 0)
                 Log::Info("Rank = %d, Evaluation Time used: %.2f s \n",
                     Multiverso::ProcessRank(), watch.ElapsedSeconds());
         }
+        // Evaluate ends with a barrier, all threads have been accounted
+        if (perf && id == 0 && block == Config::num_blocks - 1 &&
+            slice == local_vocab.num_slice() - 1)
+        {
+            RecordPerf(iter);
+        }
         // if (iter != 0 && iter % 50 == 0) Dump(iter, lda_data_block);
 
         // Clear the thread information in alias table
         if (iter == Config::num_iterations - 1) alias_->Clear();
     }
 
+    void Trainer::PrebuildAlias(AliasTable* alias, AliasTableIndex* index,
+        const LocalVocab* local_vocab, int32_t slice, ModelBase* model)
+    {
+        alias->Prebuild(index, local_vocab->begin(slice), 
+            local_vocab->end(slice), model);
+        // Free the buffers of this thread
+        alias->Clear();
+    }
+
+    void Trainer::FlushDue(int32_t num_docs)
+    {
+        if (delta_model_ == nullptr) return;
+        int32_t words = Config::coalesce_docs;
+        int32_t summary = Config::local_summary > 0 ? 
+            Config::local_summary : words;
+        if (words > 0 && num_docs % words == 0) delta_model_->FlushWords();
+        if (summary > 0 && num_docs % summary == 0) 
+            delta_model_->FlushSummary();
+    }
+
+    int32_t Trainer::WarpIteration(LDADataBlock* lda_data_block)
+    {
+        DataBlock& data = lda_data_block->data();
+        int32_t slice = lda_data_block->slice();
+        const LocalVocab& local_vocab = data.meta();
+        int32_t id = TrainerId();
+        int32_t trainer_num = TrainerCount();
+        int32_t lastword = local_vocab.LastWord(slice);
+
+        // 1. Word-major pass
+        for (const int32_t* pword = local_vocab.begin(slice) + id;
+            pword < local_vocab.end(slice);
+            pword += trainer_num)
+        {
+            warp_sampler_->SampleOneWord(data, 
+                static_cast<int32_t>(pword - local_vocab.begin(0)), *pword,
+                model_, alias_);
+        }
+        warp_sampler_->FlushSummary(model_, alias_);
+        barrier_->Wait();
+
+        // 2. Doc-major pass
+        int32_t num_token = 0;
+        if (data.HasSliceIndex())
+        {
+            const int32_t* docs = data.SliceDocs(slice);
+            const int32_t* cursors = data.SliceCursors(slice);
+            for (int32_t i = id; i < data.SliceSize(slice); i += trainer_num)
+            {
+                data.GetOneDoc(docs[i])->Cursor() = cursors[i];
+                num_token += warp_sampler_->SampleOneDoc(data, docs[i], slice,
+                    lastword, model_);
+            }
+        }
+        else
+        {
+            for (int32_t doc_id = id; doc_id < data.Size(); doc_id += trainer_num)
+            {
+                num_token += warp_sampler_->SampleOneDoc(data, doc_id, slice,
+                    lastword, model_);
+            }
+        }
+        warp_sampler_->FlushSummary(model_, alias_);
+        return num_token;
+    }
+
     void Trainer::Evaluate(LDADataBlock* lda_data_block)
     {
         double thread_doc = 0, thread_word = 0;
@@ -126,6 +341,7 @@ namespace multiverso { namespace lightlda
         if (slice == 0 && barrier_->Wait())
         {
             Log::Info("doc likelihood : %e\n", doc_llh_);
+            perf_doc_llh_ += doc_llh_;
             doc_llh_ = 0;
         }
 
@@ -133,7 +349,7 @@ namespace multiverso { namespace lightlda
         for (const int32_t* word = local_vocab.begin(slice) + TrainerId();
             word < local_vocab.end(slice) && block == 0; word += TrainerCount())
         {
-            thread_word += Eval::ComputeOneWordLLH(*word, this);
+            thread_word += Eval::ComputeOneWordLLH(*word, base_model_);
         }
         {
             std::lock_guard<std::mutex> lock(mutex_);
@@ -142,18 +358,54 @@ namespace multiverso { namespace lightlda
         if (block == 0 && barrier_->Wait())
         {
             Log::Info("word likelihood : %e\n", word_llh_);
+            perf_word_llh_ += word_llh_;
             word_llh_ = 0;
         }
 
         // 3. Evaluate normalize item for word likelihood
         if (TrainerId() == 0 && block == 0)
         {
-            Log::Info("Normalized likelihood : %e\n",
-                Eval::NormalizeWordLLH(this));
+            perf_normalized_llh_ = Eval::NormalizeWordLLH(base_model_);
+            Log::Info("Normalized likelihood : %e\n", perf_normalized_llh_);
         }
         barrier_->Wait();
     }
 
+    void Trainer::RecordPerf(int32_t iter)
+    {
+        if (Multiverso::ProcessRank() == 0)
+        {
+            std::ofstream fout(Config::perf_log, iter == 0 ?
+                std::ios::out : std::ios::app);
+            if (!fout.good())
+            {
+                Log::Fatal("Failed to open perf log %s\n",
+                    Config::perf_log.c_str());
+            }
+            if (iter == 0)
+            {
+                fout << "# seed = " << Config::seed 
+                    << ", sampler = " << sampler_->kernel_name()
+                    << ", threads = " << TrainerCount() << std::endl;
+                fout << "iter\ttokens\tseconds\ttokens_per_sec"
+                    << "\tdoc_llh\tword_llh\tnormalized_llh"
+                    << "\ttotal_llh" << std::endl;
+            }
+            double llh = perf_doc_llh_ + perf_word_llh_
+                + perf_normalized_llh_;
+            fout.precision(12);
+            fout << iter << "\t" << perf_tokens_ << "\t" << perf_seconds_
+                << "\t" << perf_tokens_ / perf_seconds_
+                << "\t" << perf_doc_llh_ << "\t" << perf_word_llh_
+                << "\t" << perf_normalized_llh_ << "\t" << llh << std::endl;
+        }
+        perf_tokens_ = 0;
+        perf_seconds_ = 0.0;
+        perf_doc_llh_ = 0.0;
+        perf_word_llh_ = 0.0;
+        perf_normalized_llh_ = 0.0;
+    }
+
     void Trainer::Dump(int32_t iter, LDADataBlock* lda_data_block)
     {
         DataBlock& data = lda_data_block->data();
@@ -187,6 +439,8 @@ namespace multiverso { namespace lightlda
 
     void ParamLoader::ParseAndRequest(DataBlockBase* data_block)
     {
+        // Without parameter server, the model is always in memory
+        if (Config::local_training) return;
         LDADataBlock* lda_data_block =
             reinterpret_cast<LDADataBlock*>(data_block);
         // Request word-topic-table
@@ -7,6 +7,7 @@
 #define LIGHTLDA_TRAINER_H_
 
 #include <mutex>
+#include <thread>
 
 #include <multiverso/multiverso.h>
 #include <multiverso/barrier.h>
@@ -14,16 +15,32 @@
 namespace multiverso { namespace lightlda
 {
     class AliasTable;
+    class AliasTableIndex;
+    class ArenaModel;
+    class DeltaModel;
     class LDADataBlock;
     class LightDocSampler;
+    class LocalVocab;
     class Meta;
+    class ModelBase;
     class PSModel;
+    class ReplicaModel;
+    class SharedModel;
+    class SliceArena;
+    class WarpSampler;
 
     /*! \brief Trainer is responsible for training a data block */
     class Trainer : public TrainerBase
     {
     public:
-        Trainer(AliasTable* alias, Barrier* barrier, Meta* meta);
+        /*!
+         * \param arena arena of the rows of a slice, shared by the trainers,
+         *  nullptr to read rows from the parameter cache
+         * \param shared_model model in memory shared by the trainers, 
+         *  nullptr to train with the parameter server
+         */
+        Trainer(AliasTable* alias, Barrier* barrier, Meta* meta,
+            SliceArena* arena, SharedModel* shared_model);
         ~Trainer();
         /*!
          * \brief Defines Trainning method for a data_block in one iteration
@@ -39,20 +56,63 @@ namespace multiverso { namespace lightlda
         void Dump(int32_t iter, LDADataBlock* lda_data_block);
 
     private:
+        /*!
+         * \brief Samples a slice with WarpSampler, a word-major pass followed
+         *  by a doc-major pass
+         * \return number of sampled token in doc-major pass
+         */
+        int32_t WarpIteration(LDADataBlock* lda_data_block);
+        /*!
+         * \brief Flushes the updates of delta_model_ due after num_docs 
+         *  documents of a slice
+         */
+        void FlushDue(int32_t num_docs);
+        /*! \brief Appends the record of an iteration to Config::perf_log */
+        void RecordPerf(int32_t iter);
+        /*! \brief Build the alias rows of a slice ahead of its Init */
+        static void PrebuildAlias(AliasTable* alias, AliasTableIndex* index,
+            const LocalVocab* local_vocab, int32_t slice, ModelBase* model);
         /*! \brief alias table, for alias access */
         AliasTable* alias_;
         /*! \brief sampler for lightlda */
         LightDocSampler* sampler_;
+        /*! \brief delayed update sampler, only used with -sampler warp */
+        WarpSampler* warp_sampler_;
+        /*! \brief whether samplers are moved to the stream of this thread */
+        bool seeded_;
         /*! \brief barrier for thread-sync */
         Barrier* barrier_;
         /*! \brief meta information */
         Meta* meta_;
         /*! \brief model acceccor */
-        PSModel * model_;
+        ModelBase* model_;
+        /*! 
+         * \brief model of the parameter server, or shared model, wrapped by
+         *  model_ in the arena model if arena, the replica model if 
+         *  hot_words, then the delta model if coalesce_docs or local_summary
+         */
+        ModelBase* base_model_;
+        PSModel* ps_model_;
+        SharedModel* shared_model_;
+        ArenaModel* arena_model_;
+        ReplicaModel* replica_model_;
+        DeltaModel* delta_model_;
+        SliceArena* arena_;
+        /*!
+         * \brief builder of the alias rows of the next slice while this 
+         *  one is sampled, run by trainer 0 with -pipeline_alias
+         */
+        std::thread builder_;
         static std::mutex mutex_;
 
         static double doc_llh_;
         static double word_llh_;
+        /*! \brief benchmark record of current iteration, for perf_log */
+        static int64_t perf_tokens_;
+        static double perf_seconds_;
+        static double perf_doc_llh_;
+        static double perf_word_llh_;
+        static double perf_normalized_llh_;
     };
 
     /*! 
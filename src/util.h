@@ -1,32 +1,83 @@
 /*!
  * \file util.h
- * \brief Defines random number generator
+ * \brief Defines random number generator and prefetch hint
  */
 
 #ifndef LIGHTLDA_UTIL_H_
 #define LIGHTLDA_UTIL_H_
 
+#include <cstdint>
 #include <ctime>
 
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+
+/*!
+ * \brief Hints the cpu to load the cache line of addr for reading. Define
+ *  LIGHTLDA_NO_PREFETCH to turn all the hints off, e.g. for comparison
+ */
+#if defined(LIGHTLDA_NO_PREFETCH)
+#define _PREFETCH(addr) ((void)(addr))
+#elif defined(_MSC_VER)
+#define _PREFETCH(addr) \
+    _mm_prefetch(reinterpret_cast<const char*>(addr), _MM_HINT_T0)
+#else
+#define _PREFETCH(addr) __builtin_prefetch((addr), 0, 3)
+#endif
+
 namespace multiverso { namespace lightlda
 {
-    /*! \brief xorshift_rng is a random number generator */
-    class xorshift_rng
+    /*!
+     * \brief philox_rng is a counter-based random number generator
+     *  (Philox4x32-10). The i-th block of 4 numbers is a pure function of
+     *  (key, stream, i): the upper half of the 128-bit counter holds the
+     *  stream id, so generators sharing a key but with different streams,
+     *  e.g. one per rank and thread, are independent. Numbers are generated
+     *  kBufferSize at a time by a loop over independent counters that
+     *  compilers vectorize, and single draws are served from the buffer.
+     */
+    class philox_rng
     {
     public:
-        xorshift_rng()
+        /*! \brief number of 32-bit values generated at a time */
+        static const int32_t kBufferSize = 256;
+
+        /*! \brief Seeds with the current time */
+        philox_rng()
         {
-            jxr_ = static_cast<unsigned int>(time(nullptr));
+            Seed(static_cast<uint64_t>(time(nullptr)));
         }
-        ~xorshift_rng() {}
+        /*! \brief Seeds with key, using stream */
+        philox_rng(uint64_t key, uint64_t stream)
+        {
+            Seed(key, stream);
+        }
+        ~philox_rng() {}
 
-        /*! \brief get random (xorshift) 32-bit integer*/
-        int32_t rand()
+        /*! \brief Restart the generator at the beginning of a stream */
+        void Seed(uint64_t key, uint64_t stream = 0)
         {
-            jxr_ ^= (jxr_ << 13); jxr_ ^= (jxr_ >> 17); jxr_ ^= (jxr_ << 5);
-            return jxr_ & 0x7fffffff;
+            key_[0] = static_cast<uint32_t>(key);
+            key_[1] = static_cast<uint32_t>(key >> 32);
+            stream_[0] = static_cast<uint32_t>(stream);
+            stream_[1] = static_cast<uint32_t>(stream >> 32);
+            counter_ = 0;
+            pos_ = kBufferSize;
+        }
+        /*! \brief Stream id of a worker thread in a process */
+        static uint64_t StreamId(int32_t rank, int32_t thread)
+        {
+            return (static_cast<uint64_t>(rank) << 32)
+                | static_cast<uint32_t>(thread);
         }
 
+        /*! \brief get random 31-bit integer */
+        int32_t rand()
+        {
+            if (pos_ == kBufferSize) Refill();
+            return static_cast<int32_t>(buffer_[pos_++] & 0x7fffffff);
+        }
         double rand_double()
         {
             return rand() * 4.6566125e-10;
@@ -35,12 +86,71 @@ namespace multiverso { namespace lightlda
         {
             return static_cast<int>(rand() * 4.6566125e-10 * K);
         }
+        /*!
+         * \brief Bulk access, get n (<= kBufferSize) consecutive random
+         *  32-bit values of the stream in place
+         */
+        const uint32_t* Next(int32_t n)
+        {
+            if (pos_ + n > kBufferSize) Refill();
+            const uint32_t* p = buffer_ + pos_;
+            pos_ += n;
+            return p;
+        }
     private:
+        /*! \brief Generate the next kBufferSize values of the stream */
+        void Refill()
+        {
+            const int32_t kBlocks = kBufferSize / 4;
+            const uint32_t kMul0 = 0xD2511F53, kMul1 = 0xCD9E8D57;
+            const uint32_t kWeyl0 = 0x9E3779B9, kWeyl1 = 0xBB67AE85;
+            uint32_t x0[kBlocks], x1[kBlocks], x2[kBlocks], x3[kBlocks];
+            for (int32_t i = 0; i < kBlocks; ++i)
+            {
+                uint64_t counter = counter_ + i;
+                x0[i] = static_cast<uint32_t>(counter);
+                x1[i] = static_cast<uint32_t>(counter >> 32);
+                x2[i] = stream_[0];
+                x3[i] = stream_[1];
+            }
+            uint32_t k0 = key_[0], k1 = key_[1];
+            for (int32_t round = 0; round < 10; ++round)
+            {
+                for (int32_t i = 0; i < kBlocks; ++i)
+                {
+                    uint64_t p0 = static_cast<uint64_t>(kMul0) * x0[i];
+                    uint64_t p1 = static_cast<uint64_t>(kMul1) * x2[i];
+                    uint32_t y0 = static_cast<uint32_t>(p1 >> 32) ^ x1[i] ^ k0;
+                    uint32_t y2 = static_cast<uint32_t>(p0 >> 32) ^ x3[i] ^ k1;
+                    x1[i] = static_cast<uint32_t>(p1);
+                    x3[i] = static_cast<uint32_t>(p0);
+                    x0[i] = y0;
+                    x2[i] = y2;
+                }
+                k0 += kWeyl0; k1 += kWeyl1;
+            }
+            for (int32_t i = 0; i < kBlocks; ++i)
+            {
+                buffer_[4 * i] = x0[i];
+                buffer_[4 * i + 1] = x1[i];
+                buffer_[4 * i + 2] = x2[i];
+                buffer_[4 * i + 3] = x3[i];
+            }
+            counter_ += kBlocks;
+            pos_ = 0;
+        }
         // No copying allowed
-        xorshift_rng(const xorshift_rng &other);
-        void operator=(const xorshift_rng &other);
-        /*! \brief seed */
-        uint32_t jxr_;
+        philox_rng(const philox_rng &other);
+        void operator=(const philox_rng &other);
+        /*! \brief key, shared by all the streams of a run */
+        uint32_t key_[2];
+        /*! \brief upper half of the counter */
+        uint32_t stream_[2];
+        /*! \brief lower half of the counter, of the next block */
+        uint64_t counter_;
+        /*! \brief next value to serve in buffer */
+        int32_t pos_;
+        uint32_t buffer_[kBufferSize];
     };
 } // namespace lightlda
 } // namespace multiverso
@@ -0,0 +1,204 @@
+#include "warp_sampler.h"
+
+#include "alias_table.h"
+#include "common.h"
+#include "data_block.h"
+#include "doc_topic_counter.h"
+#include "document.h"
+#include "meta.h"
+#include "model.h"
+
+#include <multiverso/log.h>
+#include <multiverso/row.h>
+
+namespace multiverso { namespace lightlda
+{
+    WarpSampler::WarpSampler()
+    {
+        alpha_ = Config::alpha;
+        beta_ = Config::beta;
+        num_topic_ = Config::num_topics;
+        mh_steps_ = Config::mh_steps;
+
+        alpha_sum_ = num_topic_ * alpha_;
+        beta_sum_ = Config::num_vocabs * beta_;
+
+        doc_topic_counter_.reset(new DocTopicCounter(num_topic_));
+        word_delta_.resize(num_topic_, 0);
+        summary_delta_.resize(num_topic_, 0);
+    }
+
+    WarpSampler::~WarpSampler() {}
+
+    int32_t WarpSampler::SampleOneWord(DataBlock& data, int32_t vocab_index,
+        int32_t word, ModelBase* model, AliasTable* alias)
+    {
+        float n_tw_beta, n_sw_beta, n_t_beta_sum, n_s_beta_sum;
+        double rejection;
+        int32_t m, t, s;
+
+        if (Config::lazy_alias) alias->EnsureBuilt(word, model);
+        // Both rows stay unchanged while sampling this word, since own
+        // updates are delayed
+        WordTopicRow word_topic_row = model->GetWordTopicRow(word);
+        SummaryRow summary_row = model->GetSummaryRow();
+        WordEntry& word_entry = alias->word_entry(word);
+
+        const int64_t* begin;
+        const int64_t* end;
+        data.WordSlots(vocab_index, begin, end);
+        for (const int64_t* slot = begin; slot != end; ++slot)
+        {
+            // Tokens of a word are scattered over the block
+            if (end - slot > kPrefetchDistance)
+            {
+                int64_t ahead = slot[kPrefetchDistance];
+                _PREFETCH(&data.Topic(ahead));
+                _PREFETCH(data.proposals() + DataBlock::ProposalIndex(ahead));
+            }
+            int32_t& topic = data.Topic(*slot);
+            int32_t* proposal = data.proposals()
+                + DataBlock::ProposalIndex(*slot);
+            int32_t old_topic = topic;
+            s = old_topic;
+            for (int32_t i = 0; i < mh_steps_; ++i)
+            {
+                // Accept or reject doc proposal of last doc-major pass
+                t = proposal[i];
+                if (t >= 0 && t != s)
+                {
+                    n_tw_beta = word_topic_row.At(t) + beta_;
+                    n_sw_beta = word_topic_row.At(s) + beta_;
+                    n_t_beta_sum = summary_row.At(t) + beta_sum_;
+                    n_s_beta_sum = summary_row.At(s) + beta_sum_;
+                    if (t == old_topic)
+                    {
+                        n_tw_beta -= 1;
+                        n_t_beta_sum -= 1;
+                    }
+                    if (s == old_topic)
+                    {
+                        n_sw_beta -= 1;
+                        n_s_beta_sum -= 1;
+                    }
+                    rejection = rng_.rand_double();
+                    m = -(rejection * (n_sw_beta * n_t_beta_sum) < 
+                        n_tw_beta * n_s_beta_sum);
+                    s = (t & m) | (s & ~m);
+                }
+                // Draw word proposal for next doc-major pass
+                proposal[i] = alias->Propose(word, word_entry, rng_);
+            }
+            if (s != old_topic)
+            {
+                topic = s;
+                if (word_delta_[old_topic]-- == 0)
+                    word_touched_.push_back(old_topic);
+                if (word_delta_[s]++ == 0)
+                    word_touched_.push_back(s);
+                UpdateSummary(old_topic, s);
+            }
+        }
+        for (int32_t k : word_touched_)
+        {
+            if (word_delta_[k] != 0)
+            {
+                model->AddWordTopicRow(word, k, word_delta_[k]);
+                word_delta_[k] = 0;
+            }
+        }
+        word_touched_.clear();
+        return static_cast<int32_t>(end - begin);
+    }
+
+    int32_t WarpSampler::SampleOneDoc(DataBlock& data, int32_t index,
+        int32_t slice, int32_t lastword, ModelBase* model)
+    {
+        float nominator, denominator;
+        double rejection;
+        int32_t m, t, s;
+
+        Document* doc = data.GetOneDoc(index);
+        doc->GetDocTopicVector(*doc_topic_counter_);
+
+        int32_t num_tokens = 0;
+        int32_t& cursor = doc->Cursor();
+        if (slice == 0) cursor = 0;
+        int32_t* proposal = data.proposals()
+            + DataBlock::ProposalIndex(data.FirstSlot(index) + 2 * cursor);
+        for (; cursor != doc->Size(); ++cursor, proposal += mh_steps_)
+        {
+            int32_t word = doc->Word(cursor);
+            if (word > lastword) break;
+            int32_t old_topic = doc->Topic(cursor);
+            s = old_topic;
+            for (int32_t i = 0; i < mh_steps_; ++i)
+            {
+                // Accept or reject word proposal of last word-major pass
+                t = proposal[i];
+                if (t >= 0 && t != s)
+                {
+                    nominator = doc_topic_counter_->At(t) + alpha_;
+                    denominator = doc_topic_counter_->At(s) + alpha_;
+                    if (t == old_topic)
+                    {
+                        nominator -= 1;
+                    }
+                    if (s == old_topic)
+                    {
+                        denominator -= 1;
+                    }
+                    rejection = rng_.rand_double();
+                    m = -(rejection * denominator < nominator);
+                    s = (t & m) | (s & ~m);
+                }
+                // Draw doc proposal for next word-major pass
+                double n_td_or_alpha = rng_.rand_double() *
+                    (doc->Size() + alpha_sum_);
+                if (n_td_or_alpha < doc->Size())
+                {
+                    int32_t t_idx = static_cast<int32_t>(n_td_or_alpha);
+                    proposal[i] = doc->Topic(t_idx);
+                }
+                else
+                {
+                    proposal[i] = rng_.rand_k(num_topic_);
+                }
+            }
+            if (s != old_topic)
+            {
+                doc->SetTopic(cursor, s);
+                doc_topic_counter_->Add(old_topic, -1);
+                doc_topic_counter_->Add(s, 1);
+                model->AddWordTopicRow(word, old_topic, -1);
+                model->AddWordTopicRow(word, s, 1);
+                UpdateSummary(old_topic, s);
+            }
+            ++num_tokens;
+        }
+        return num_tokens;
+    }
+
+    void WarpSampler::UpdateSummary(int32_t old_topic, int32_t new_topic)
+    {
+        if (summary_delta_[old_topic]-- == 0)
+            summary_touched_.push_back(old_topic);
+        if (summary_delta_[new_topic]++ == 0)
+            summary_touched_.push_back(new_topic);
+    }
+
+    void WarpSampler::FlushSummary(ModelBase* model, AliasTable* alias)
+    {
+        for (int32_t k : summary_touched_)
+        {
+            if (summary_delta_[k] != 0)
+            {
+                model->AddSummaryRow(k, summary_delta_[k]);
+                summary_delta_[k] = 0;
+                alias->UpdateInvSummary(k, model->GetSummaryRow().At(k));
+            }
+        }
+        summary_touched_.clear();
+    }
+} // namespace lightlda
+} // namespace multiverso
@@ -0,0 +1,94 @@
+/*!
+ * \file warp_sampler.h
+ * \brief Defines the delayed update sampler in the style of WarpLDA
+ */
+
+#ifndef LIGHTLDA_WARP_SAMPLER_H_
+#define LIGHTLDA_WARP_SAMPLER_H_
+
+#include <memory>
+#include <vector>
+#include "util.h"
+
+namespace multiverso { namespace lightlda
+{
+    class AliasTable;
+    class DocTopicCounter;
+    class DataBlock;
+    class ModelBase;
+
+    /*!
+     * \brief WarpSampler factorizes the Metropolis-Hastings acceptance rate
+     *  the same way as ApproxSample, and visits the tokens of a slice twice:
+     *  1) a word-major pass, which only reads the word-topic row of the
+     *  current word and the summary row. It accepts/rejects the doc
+     *  proposals and draws new word proposals from the alias table.
+     *  2) a doc-major pass, which only reads the doc-topic counter of the
+     *  current document. It accepts/rejects the word proposals and draws
+     *  new doc proposals.
+     *  Proposals are kept per token in the data block between the passes.
+     *  Updates to word-topic rows are delayed until a word is finished,
+     *  updates to summary row are delayed until a pass is finished.
+     */
+    class WarpSampler
+    {
+    public:
+        WarpSampler();
+        ~WarpSampler();
+        /*!
+         * \brief Sample all tokens of one word, word-major pass
+         * \param data data block, must have word index built
+         * \param vocab_index position of the word in local vocab
+         * \param word word id
+         * \param model pointer model, for access of model
+         * \param alias pointer to alias table, for access of alias
+         * \return number of sampled token
+         */
+        int32_t SampleOneWord(DataBlock& data, int32_t vocab_index,
+            int32_t word, ModelBase* model, AliasTable* alias);
+        /*!
+         * \brief Sample tokens of one document in current slice,
+         *  doc-major pass
+         * \param data data block, must have word index built
+         * \param index document index in data block
+         * \param slice slice id
+         * \param lastword last word of current slice
+         * \param model pointer model, for access of model
+         * \return number of sampled token
+         */
+        int32_t SampleOneDoc(DataBlock& data, int32_t index, int32_t slice,
+            int32_t lastword, ModelBase* model);
+        /*! \brief Restart random number generator at a stream */
+        void Seed(uint64_t key, uint64_t stream) { rng_.Seed(key, stream); }
+        /*!
+         * \brief Flush the delayed summary row updates to model, and 
+         *  refresh the reciprocal summary of the topics in alias
+         */
+        void FlushSummary(ModelBase* model, AliasTable* alias);
+    private:
+        /*! \brief Record the change of a token from old_topic to new_topic */
+        void UpdateSummary(int32_t old_topic, int32_t new_topic);
+        /*! \brief number of tokens prefetched ahead in word-major pass */
+        static const int32_t kPrefetchDistance = 8;
+        // lda hyper-parameter
+        float alpha_;
+        float beta_;
+        float alpha_sum_;
+        float beta_sum_;
+
+        int32_t num_topic_;
+        int32_t mh_steps_;
+
+        philox_rng rng_;
+        std::unique_ptr<DocTopicCounter> doc_topic_counter_;
+        /*! \brief delayed delta of current word */
+        std::vector<int32_t> word_delta_;
+        std::vector<int32_t> word_touched_;
+        /*! \brief delayed delta of summary row */
+        std::vector<int64_t> summary_delta_;
+        std::vector<int32_t> summary_touched_;
+    };
+} // namespace lightlda
+} // namespace multiverso
+
+#endif // LIGHTLDA_WARP_SAMPLER_H_